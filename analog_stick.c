@@ -0,0 +1,259 @@
+/*
+ * Implements an analog stick read through an ADS1115 ADC, with calibration,
+ * smoothing and a deadzone, reported as ABS_X and ABS_Y
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analog_stick.h"
+#include "config.h"
+#include "i2c_bus.h"
+
+// Register values
+#define REG_CONVERSION  0x00
+#define REG_CONFIG      0x01
+
+// Single shot conversion of AIN0 + `channel` against ground, +-4.096 V, 860
+// samples/s, comparator off
+#define CONFIG_START    0x8000
+#define CONFIG_MUX(ch)  ((0x4 + (ch)) << 12)
+#define CONFIG_FIXED    0x03E3
+
+// Defaults for a 3.3 V potentiometer, read against the 4.096 V range
+#define DEFAULT_MAXIMUM     26400
+#define DEFAULT_DEADZONE    0.08
+#define DEFAULT_SMOOTHING   0.5
+#define DEFAULT_THRESHOLD   256
+
+/*
+ * Private helper functions
+ */
+static int write_register(analog_stick* stick, uint8_t reg, uint16_t value)
+{
+    // The ADS1115 sends its registers most significant byte first
+    uint8_t buf[3] = { reg, value >> 8, value & 0xFF };
+    return i2c_transfer(stick->i2c_bus, stick->addr, buf, 3, NULL, 0);
+}
+static int read_register(analog_stick* stick, uint8_t reg, int16_t* value)
+{
+    uint8_t buf[2];
+    if (i2c_transfer(stick->i2c_bus, stick->addr, &reg, 1, buf, 2) < 0)
+    {
+        return -1;
+    }
+    *value = (int16_t)((buf[0] << 8) | buf[1]);
+    return 0;
+}
+static int start_conversion(analog_stick* stick)
+{
+    return write_register(stick, REG_CONFIG,
+        CONFIG_START | CONFIG_MUX(stick->channel) | CONFIG_FIXED);
+}
+
+// Maps a smoothed raw value to the reported range
+static int32_t axis_position(const analog_stick* stick,
+    const stick_axis* axis)
+{
+    double offset = axis->filtered - axis->center;
+    double to_max = axis->maximum - axis->center;
+    double to_min = axis->center - axis->minimum;
+    double position = 0;
+    // Either side may run towards lower raw values on an inverted axis
+    if ((offset >= 0) == (to_max >= 0))
+    {
+        if (to_max != 0) position = offset / to_max;
+    }
+    else if (to_min != 0)
+    {
+        position = offset / to_min;
+    }
+    if (position > 1) position = 1;
+    if (position < -1) position = -1;
+
+    // Scale what is left outside the deadzone back to the full range
+    if (fabs(position) <= stick->deadzone)
+    {
+        return 0;
+    }
+    position = copysign((fabs(position) - stick->deadzone)
+        / (1 - stick->deadzone), position);
+    return (int32_t)lround(position * ANALOG_STICK_MAX);
+}
+
+/*
+ * Sets up `stick` with default calibration and filtering, disabled
+ */
+void init_analog_stick(analog_stick* stick)
+{
+    memset(stick, 0, sizeof(analog_stick));
+    stick->i2c_bus = -1;
+    stick->deadzone = DEFAULT_DEADZONE;
+    stick->smoothing = DEFAULT_SMOOTHING;
+    stick->threshold = DEFAULT_THRESHOLD;
+    for (int i = 0; i < ANALOG_STICK_AXES; i++)
+    {
+        stick->axes[i].code = i == 0 ? ABS_X : ABS_Y;
+        stick->axes[i].minimum = 0;
+        stick->axes[i].center = DEFAULT_MAXIMUM / 2;
+        stick->axes[i].maximum = DEFAULT_MAXIMUM;
+        stick->axes[i].filtered = -1;
+    }
+}
+
+/*
+ * Applies the configuration entry `key` = `value`: rate_hz, deadzone,
+ * smoothing, threshold, or x_calibration / y_calibration as "min center max".
+ * Returns zero on success, and a negative value on an unknown key or invalid
+ * value
+ */
+int configure_analog_stick(analog_stick* stick, const char* key,
+    const char* value)
+{
+    unsigned int number;
+    double fraction;
+    if (strcmp(key, "rate_hz") == 0)
+    {
+        if (parse_config_uint(value, &number) != 0
+            || number > ANALOG_STICK_MAX_RATE)
+        {
+            return -2;
+        }
+        stick->rate = number;
+    }
+    else if (strcmp(key, "deadzone") == 0 || strcmp(key, "smoothing") == 0)
+    {
+        if (parse_config_double(value, &fraction) != 0 || fraction >= 1)
+        {
+            return -2;
+        }
+        if (key[0] == 'd') stick->deadzone = fraction;
+        else stick->smoothing = fraction;
+    }
+    else if (strcmp(key, "threshold") == 0)
+    {
+        if (parse_config_uint(value, &number) != 0
+            || number > ANALOG_STICK_MAX)
+        {
+            return -2;
+        }
+        stick->threshold = number;
+    }
+    else if (strcmp(key, "x_calibration") == 0
+        || strcmp(key, "y_calibration") == 0)
+    {
+        char buf[CONFIG_LINE_LEN], *tokens[3];
+        unsigned int raw[3];
+        stick_axis* axis = &stick->axes[key[0] == 'x' ? 0 : 1];
+        strncpy(buf, value, sizeof(buf) - 1);
+        buf[sizeof(buf) - 1] = '\0';
+        if (split_config_value(buf, tokens, 3) != 3)
+        {
+            return -2;
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            if (parse_config_uint(tokens[i], &raw[i]) != 0 || raw[i] > 32767)
+            {
+                return -2;
+            }
+        }
+        axis->minimum = raw[0];
+        axis->center = raw[1];
+        axis->maximum = raw[2];
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Opens the ADC at `addr` on `bus` and starts the first conversion. Returns
+ * zero on success, and a negative value on errors
+ */
+int open_analog_stick(analog_stick* stick, long addr, char* bus)
+{
+    stick->addr = addr;
+    stick->i2c_bus = open_i2c_device(bus, addr);
+    if (stick->i2c_bus < 0)
+    {
+        return -1;
+    }
+    stick->channel = 0;
+    if (start_conversion(stick) != 0)
+    {
+        close_analog_stick(stick);
+        return -3;
+    }
+    return 0;
+}
+
+/*
+ * Returns the ns between two calls of `analog_stick_step`
+ */
+uint64_t analog_stick_period(const analog_stick* stick)
+{
+    // Each step converts one axis
+    return 1000000000ULL / (stick->rate * ANALOG_STICK_AXES);
+}
+
+/*
+ * Reads the conversion started by the previous step and starts the next one,
+ * alternating axes. Writes an ABS event to `event` and returns 1 if the axis
+ * moved past the threshold, 0 if not, and a negative value on read errors
+ */
+int analog_stick_step(analog_stick* stick, device_event* event)
+{
+    stick_axis* axis = &stick->axes[stick->channel];
+    int16_t raw = 0;
+    int32_t position;
+    int ret = read_register(stick, REG_CONVERSION, &raw);
+
+    // Keep converting even after a failed read, the next one may work
+    stick->channel = (stick->channel + 1) % ANALOG_STICK_AXES;
+    if (start_conversion(stick) != 0 || ret != 0)
+    {
+        stick->errors++;
+        return -1;
+    }
+    stick->conversions++;
+
+    // Single ended inputs only go slightly below zero from noise
+    if (raw < 0) raw = 0;
+    if (axis->filtered < 0)
+    {
+        axis->filtered = raw;
+    }
+    else
+    {
+        axis->filtered = stick->smoothing * axis->filtered
+            + (1 - stick->smoothing) * raw;
+    }
+
+    // Small moves are noise, but rest and the ends are always reported
+    position = axis_position(stick, axis);
+    if (position == axis->value || (abs(position - axis->value)
+        < stick->threshold && position != 0
+        && abs(position) != ANALOG_STICK_MAX))
+    {
+        return 0;
+    }
+    axis->value = position;
+    stick->reports++;
+    event->type = EV_ABS;
+    event->code = axis->code;
+    event->value = position;
+    return 1;
+}
+
+/*
+ * Closes the ADC bus
+ */
+void close_analog_stick(analog_stick* stick)
+{
+    if (stick->i2c_bus >= 0) close_i2c_device(stick->i2c_bus);
+    stick->i2c_bus = -1;
+}
@@ -0,0 +1,80 @@
+/*
+ * Implements an analog stick read through an ADS1115 ADC, with calibration,
+ * smoothing and a deadzone, reported as ABS_X and ABS_Y
+ */
+
+#ifndef ANALOG_STICK_H
+#define ANALOG_STICK_H
+
+#include <stdint.h>
+
+#include "input_device.h"
+
+#define ANALOG_STICK_AXES       2
+#define ANALOG_STICK_MAX_RATE   300     // Hz per axis at 860 samples/s
+#define ANALOG_STICK_MAX        32767   // ABS_X/ABS_Y range is +-this
+
+/*
+ * One axis, raw values are ADC counts and may run from high to low
+ */
+typedef struct {
+    uint16_t code;              // ABS_X or ABS_Y
+    int32_t minimum;            // Raw value at full deflection one way
+    int32_t center;             // Raw value at rest
+    int32_t maximum;            // Raw value at full deflection the other way
+    double filtered;            // Smoothed raw value, below 0 before a sample
+    int32_t value;              // Last reported position
+} stick_axis;
+
+typedef struct {
+    int i2c_bus;
+    uint16_t addr;
+    unsigned int rate;          // Reports per second and axis, 0 is off
+    double deadzone;            // Fraction of each half reported as rest
+    double smoothing;           // Weight of the previous value, 0 - 1
+    int32_t threshold;          // Change needed before a position is reported
+    int channel;                // Axis whose conversion is running
+    stick_axis axes[ANALOG_STICK_AXES];
+    unsigned long conversions;
+    unsigned long reports;
+    unsigned long errors;
+} analog_stick;
+
+/*
+ * Sets up `stick` with default calibration and filtering, disabled
+ */
+void init_analog_stick(analog_stick* stick);
+
+/*
+ * Applies the configuration entry `key` = `value`: rate_hz, deadzone,
+ * smoothing, threshold, or x_calibration / y_calibration as "min center max".
+ * Returns zero on success, and a negative value on an unknown key or invalid
+ * value
+ */
+int configure_analog_stick(analog_stick* stick, const char* key,
+    const char* value);
+
+/*
+ * Opens the ADC at `addr` on `bus` and starts the first conversion. Returns
+ * zero on success, and a negative value on errors
+ */
+int open_analog_stick(analog_stick* stick, long addr, char* bus);
+
+/*
+ * Returns the ns between two calls of `analog_stick_step`
+ */
+uint64_t analog_stick_period(const analog_stick* stick);
+
+/*
+ * Reads the conversion started by the previous step and starts the next one,
+ * alternating axes. Writes an ABS event to `event` and returns 1 if the axis
+ * moved past the threshold, 0 if not, and a negative value on read errors
+ */
+int analog_stick_step(analog_stick* stick, device_event* event);
+
+/*
+ * Closes the ADC bus
+ */
+void close_analog_stick(analog_stick* stick);
+
+#endif
@@ -3,22 +3,30 @@
  */
 
 #include <stdlib.h>
-
-// Needed for i2c bus
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
+#include <time.h>
 
 #include "arcade_buttons.h"
+#include "i2c_bus.h"
 
 // Register values
 #define IODIRA  0x00
 #define IOCONA  0x0A
+#define INTFA   0x0E
 #define INTCAPA 0x10
 
 #define CONSUMER_NAME "arcade-bonnet"
 #define EVENT_BUFFER_LEN 64
 
+/*
+ * Private helper functions
+ */
+static uint64_t now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
 /*
  * Sets initial MCP23017 config and returns a configuration struct
  */
@@ -27,23 +35,23 @@ arcade_bonnet* configure_arcade_bonnet(long addr, char* bus)
     uint8_t buf[16];
     arcade_bonnet* bonnet = malloc(sizeof(arcade_bonnet));
     bonnet->int_pin = NULL;
+    bonnet->edge_time = 0;
+    bonnet->read_time = 0;
+    bonnet->addr = addr;
+    bonnet->state = 0xFFFF;
     
     // Open bus
-    bonnet->i2c_bus = open(bus, O_RDWR);
+    bonnet->i2c_bus = open_i2c_device(bus, addr);
     if (bonnet->i2c_bus < 0)
     {
-        return NULL;
-    }
-    else if (ioctl(bonnet->i2c_bus, I2C_SLAVE, addr))
-    {
-        close_arcade_bonnet(bonnet);
+        free(bonnet);
         return NULL;
     }
     
     // If bank 1, switch to 0
     buf[0] = 0x05;
     buf[1] = 0x00;
-    if (write(bonnet->i2c_bus, buf, 2) != 2)
+    if (i2c_transfer(bonnet->i2c_bus, addr, buf, 2, NULL, 0) < 0)
     {
         close_arcade_bonnet(bonnet);
         return NULL;
@@ -52,7 +60,7 @@ arcade_bonnet* configure_arcade_bonnet(long addr, char* bus)
     // Bank 0, INTB=A, seq, OD IRQ
     buf[0] = IOCONA;
     buf[1] = 0x44;
-    if (write(bonnet->i2c_bus, buf, 2) != 2)
+    if (i2c_transfer(bonnet->i2c_bus, addr, buf, 2, NULL, 0) < 0)
     {
         close_arcade_bonnet(bonnet);
         return NULL;
@@ -60,12 +68,7 @@ arcade_bonnet* configure_arcade_bonnet(long addr, char* bus)
 
     // Read in config values
     buf[0] = IODIRA;
-    if (write(bonnet->i2c_bus, buf, 1) != 1)
-    {
-        close_arcade_bonnet(bonnet);
-        return NULL;
-    }
-    if (read(bonnet->i2c_bus, buf + 1, 14) != 14)
+    if (i2c_transfer(bonnet->i2c_bus, addr, buf, 1, buf + 1, 14) < 0)
     {
         close_arcade_bonnet(bonnet);
         return NULL;
@@ -80,44 +83,129 @@ arcade_bonnet* configure_arcade_bonnet(long addr, char* bus)
     // Pull-ups
     buf[0xD] = 0xFF; buf[0xE] = 0xFF;
     // Write to register
-    if (write(bonnet->i2c_bus, buf, 15) != 15) {
+    if (i2c_transfer(bonnet->i2c_bus, addr, buf, 15, NULL, 0) < 0) {
         close_arcade_bonnet(bonnet);
         return NULL;
     }
 
     // Clear interrupt with read
     read_buttons_pressed(bonnet);
+    bonnet->int_flags = 0;
     return bonnet;
 }
 
 /*
- * Updates the current button state, and returns 1 if there are changes from the
- * last update, -1 on read error, otherwise 0
+ * Updates the current button state along with the interrupt flags and capture
+ * in one bus transaction. Returns 1 if there are changes from the last update,
+ * including a change that was captured and already undone, -1 on read error,
+ * otherwise 0
  */
 int read_buttons_pressed(arcade_bonnet* bonnet)
 {
-    uint8_t buf[5];
-    uint16_t val;
+    uint8_t reg = INTFA, buf[6];
     arcade_buttons old_state = bonnet->state;
 
-    // Write register values
-    buf[0] = INTCAPA;
-    if (write(bonnet->i2c_bus, buf, 1) != 1)
+    // INTFA/B, INTCAPA/B and GPIOA/B are consecutive, read them with a
+    // repeated start. Reading GPIO clears the interrupt
+    if (i2c_transfer(bonnet->i2c_bus, bonnet->addr, &reg, 1, buf, 6) < 0)
     {
         return -1;
     }
-    
-    if (read(bonnet->i2c_bus, buf, 4) != 4)
+
+    bonnet->read_time = now_ns();
+    bonnet->int_flags = buf[0] | (buf[1] << 8);
+    bonnet->captured = (arcade_buttons)(buf[2] | (buf[3] << 8));
+    bonnet->state = (arcade_buttons)(buf[4] | (buf[5] << 8));
+    return bonnet->state != old_state
+        || (bonnet->int_flags && bonnet->captured != old_state);
+}
+
+/*
+ * Reads the interrupt flags, and the capture and current state only if they
+ * show a latched interrupt, for expanders sharing an interrupt line. Returns
+ * 1 if there are changes from the last update, -1 on read error, otherwise 0
+ */
+int read_buttons_flagged(arcade_bonnet* bonnet)
+{
+    uint8_t reg = INTFA, buf[4];
+    arcade_buttons old_state = bonnet->state;
+
+    if (i2c_transfer(bonnet->i2c_bus, bonnet->addr, &reg, 1, buf, 2) < 0)
+    {
+        return -1;
+    }
+    // No latched interrupt means the state did not change since the last read
+    bonnet->read_time = now_ns();
+    bonnet->int_flags = buf[0] | (buf[1] << 8);
+    if (!bonnet->int_flags)
+    {
+        return 0;
+    }
+
+    // INTCAPA/B and GPIOA/B follow, reading GPIO clears the interrupt
+    reg = INTCAPA;
+    if (i2c_transfer(bonnet->i2c_bus, bonnet->addr, &reg, 1, buf, 4) < 0)
     {
         return -1;
     }
+    bonnet->captured = (arcade_buttons)(buf[0] | (buf[1] << 8));
+    bonnet->state = (arcade_buttons)(buf[2] | (buf[3] << 8));
+    return bonnet->state != old_state || bonnet->captured != old_state;
+}
 
-    val = buf[2] | (buf[3] << 8);
-    bonnet->state = (arcade_buttons)val;
-    return bonnet->state != old_state;
+/*
+ * Writes the states the buttons went through since `last` to `states`, oldest
+ * first, and returns how many there are (0 - 2). A tap shorter than the time
+ * between reads shows up as the captured state followed by the current one
+ */
+int button_state_sequence(
+    const arcade_bonnet* bonnet, arcade_buttons last, arcade_buttons* states)
+{
+    int count = 0;
+    // INTCAP is only meaningful while INTF shows an interrupt was latched
+    if (bonnet->int_flags && bonnet->captured != last)
+    {
+        states[count++] = bonnet->captured;
+        last = bonnet->captured;
+    }
+    if (bonnet->state != last)
+    {
+        states[count++] = bonnet->state;
+    }
+    return count;
 }
 
 #ifdef GPIO_INT
+/*
+ * Private helper functions
+ */
+static int drain_edge_events(arcade_bonnet* bonnet, int readable)
+{
+    bonnet->edge_time = 0;
+    // Drain every queued edge, a full buffer means more may be waiting
+    while (readable
+        || gpiod_line_request_wait_edge_events(bonnet->int_pin, 0) > 0)
+    {
+        int ret = gpiod_line_request_read_edge_events(
+            bonnet->int_pin, bonnet->events, EVENT_BUFFER_LEN);
+        if (ret < 0)
+        {
+            return -1;
+        }
+        if (ret > 0 && !bonnet->edge_time)
+        {
+            bonnet->edge_time = gpiod_edge_event_get_timestamp_ns(
+                gpiod_edge_event_buffer_get_event(bonnet->events, 0));
+        }
+        if (ret < EVENT_BUFFER_LEN)
+        {
+            break;
+        }
+        readable = 0;
+    }
+    return 0;
+}
+
 /*
  * Configures a pin change interrupt on button value changes, returns negative
  * number on error, zero on success, and a negative value on errors
@@ -125,7 +213,6 @@ int read_buttons_pressed(arcade_bonnet* bonnet)
 int configure_button_interrupt(
     const char* gpiochip, unsigned int pin, arcade_bonnet* bonnet)
 {
-    struct gpiod_line_request *request = NULL;
     struct gpiod_chip* gpio = gpiod_chip_open(gpiochip);
     struct gpiod_line_settings *settings = gpiod_line_settings_new();
     struct gpiod_line_config *line_cfg = gpiod_line_config_new();
@@ -144,6 +231,7 @@ int configure_button_interrupt(
     }
     gpiod_line_settings_set_direction(settings, GPIOD_LINE_DIRECTION_INPUT);
     gpiod_line_settings_set_edge_detection(settings, GPIOD_LINE_EDGE_FALLING);
+    gpiod_line_settings_set_event_clock(settings, GPIOD_LINE_CLOCK_MONOTONIC);
     gpiod_request_config_set_consumer(req_cfg, CONSUMER_NAME);
     if(gpiod_line_config_add_line_settings(line_cfg, &pin, 1, settings) != 0)
     {
@@ -156,6 +244,10 @@ int configure_button_interrupt(
     }
     bonnet->int_pin = gpiod_chip_request_lines(gpio, req_cfg, line_cfg);
     bonnet->events = gpiod_edge_event_buffer_new(EVENT_BUFFER_LEN);
+    bonnet->int_offset = pin;
+    bonnet->int_low = 0;
+    bonnet->int_checked = 0;
+    bonnet->recoveries = 0;
     gpiod_line_settings_free(settings);
     gpiod_line_config_free(line_cfg);
     gpiod_request_config_free(req_cfg);
@@ -169,20 +261,90 @@ int configure_button_interrupt(
 }
 
 /*
- * Waits for a button press interrupt, then reads the new button and immediatly
- * returns 1. If there are no events in `ms` milliseconds, returns 0
+ * Returns a file descriptor that becomes readable on button interrupts
+ */
+int button_interrupt_fd(arcade_bonnet* bonnet)
+{
+    return gpiod_line_request_get_fd(bonnet->int_pin);
+}
+
+/*
+ * Consumes pending interrupt events, keeping the kernel timestamp of the
+ * earliest edge in `edge_time`, and reads the new button state. Returns 1 if
+ * there are changes from the last update, -1 on read error, otherwise 0
  */
-int wait_for_button_interrupt(arcade_bonnet* bonnet, int ms)
+int read_button_interrupt(arcade_bonnet* bonnet)
 {
-    int ret = gpiod_line_request_wait_edge_events(
-        bonnet->int_pin, ms * 1000000);
-    if (ret > 0)
+    if (drain_edge_events(bonnet, 1) != 0)
     {
-        // Read event(s) from line to clear it
-        gpiod_edge_event_buffer_get_event(bonnet->events, ret);
-        return read_buttons_pressed(bonnet);
+        return -1;
+    }
+    return read_buttons_pressed(bonnet);
+}
+
+/*
+ * Consumes interrupt events already queued, without waiting for any or reading
+ * the buttons, keeping the kernel timestamp of the earliest edge in
+ * `edge_time` (0 if there was none). Returns zero on success, and a negative
+ * value on errors
+ */
+int consume_button_interrupt(arcade_bonnet* bonnet)
+{
+    return drain_edge_events(bonnet, 0);
+}
+
+/*
+ * Samples the interrupt line without waiting, returns 1 if it is asserted, 0
+ * if not, and -1 on errors
+ */
+int button_interrupt_asserted(arcade_bonnet* bonnet)
+{
+    enum gpiod_line_value value = gpiod_line_request_get_value(
+        bonnet->int_pin, bonnet->int_offset);
+    if (value == GPIOD_LINE_VALUE_ERROR)
+    {
+        return -1;
+    }
+    // Open drain output, low means asserted
+    return value == GPIOD_LINE_VALUE_INACTIVE;
+}
+
+/*
+ * Checks for an interrupt that stayed asserted since the previous check
+ * without any read, e.g. after a failed read or a missed edge, and clears it
+ * with a read. Call it periodically. Returns 1 if a recovery read updated the
+ * state, 0 if the line is fine, -1 if the line cannot be read, and -2 if the
+ * recovery read failed. Only successful recoveries count in `recoveries`
+ */
+int recover_button_interrupt(arcade_bonnet* bonnet)
+{
+    uint64_t previous = bonnet->int_checked;
+    int was_low = bonnet->int_low;
+    enum gpiod_line_value value = gpiod_line_request_get_value(
+        bonnet->int_pin, bonnet->int_offset);
+
+    bonnet->int_checked = now_ns();
+    if (value == GPIOD_LINE_VALUE_ERROR)
+    {
+        return -1;
+    }
+    // Open drain output, low means asserted
+    bonnet->int_low = value == GPIOD_LINE_VALUE_INACTIVE;
+    if (!bonnet->int_low || !was_low || bonnet->read_time > previous)
+    {
+        return 0;
+    }
+
+    // Nothing serviced the interrupt for a whole check period. A failed read
+    // leaves it asserted, and the next check but one tries again
+    bonnet->int_low = 0;
+    bonnet->edge_time = 0;
+    if (read_buttons_pressed(bonnet) < 0)
+    {
+        return -2;
     }
-    return ret;
+    bonnet->recoveries++;
+    return 1;
 }
 #endif
 
@@ -191,7 +353,7 @@ int wait_for_button_interrupt(arcade_bonnet* bonnet, int ms)
  */
 void close_arcade_bonnet(arcade_bonnet* bonnet)
 {
-    close(bonnet->i2c_bus);
+    close_i2c_device(bonnet->i2c_bus);
     if (bonnet->int_pin)
     {
         #ifdef GPIO_INT
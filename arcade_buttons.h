@@ -13,6 +13,7 @@
 #endif
 
 #define ARCADE_BUTTONS_COUNT 14
+#define ARCADE_BONNETS_MAX   4      // Expanders on one bus, a player each
 
 typedef enum {
     BUTTON_1A   = 0x0001,
@@ -33,10 +34,20 @@ typedef enum {
 
 typedef struct {
     int i2c_bus;
+    uint16_t addr;
     arcade_buttons state;
+    arcade_buttons captured;    // State latched at the last interrupt (INTCAP)
+    uint16_t int_flags;         // Pins that raised that interrupt (INTF)
+    uint64_t edge_time;     // CLOCK_MONOTONIC ns of the interrupt edge behind
+                            // `state`, 0 when it was polled
+    uint64_t read_time;     // CLOCK_MONOTONIC ns when `state` was read
 #ifdef GPIO_INT
 	struct gpiod_line_request* int_pin;
     struct gpiod_edge_event_buffer* events;
+    unsigned int int_offset;
+    int int_low;            // Line was asserted at the previous check
+    uint64_t int_checked;   // CLOCK_MONOTONIC ns of the previous check
+    unsigned long recoveries;
 #else
     void* int_pin;
 #endif
@@ -48,11 +59,28 @@ typedef struct {
 arcade_bonnet* configure_arcade_bonnet(long addr, char* bus);
 
 /*
- * Updates the current button state, and returns 1 if there are changes from the
- * last update, -1 on read error, otherwise 0
+ * Updates the current button state along with the interrupt flags and capture
+ * in one bus transaction. Returns 1 if there are changes from the last update,
+ * including a change that was captured and already undone, -1 on read error,
+ * otherwise 0
  */
 int read_buttons_pressed(arcade_bonnet* bonnet);
 
+/*
+ * Reads the interrupt flags, and the capture and current state only if they
+ * show a latched interrupt, for expanders sharing an interrupt line. Returns
+ * 1 if there are changes from the last update, -1 on read error, otherwise 0
+ */
+int read_buttons_flagged(arcade_bonnet* bonnet);
+
+/*
+ * Writes the states the buttons went through since `last` to `states`, oldest
+ * first, and returns how many there are (0 - 2). A tap shorter than the time
+ * between reads shows up as the captured state followed by the current one
+ */
+int button_state_sequence(
+    const arcade_bonnet* bonnet, arcade_buttons last, arcade_buttons* states);
+
 #ifdef GPIO_INT
 /*
  * Configures a pin change interrupt on button value changes, returns negative
@@ -62,10 +90,39 @@ int configure_button_interrupt(
     const char* gpiochip, unsigned int pin, arcade_bonnet* bonnet);
 
 /*
- * Waits for a button press interrupt, then reads the new button and immediatly
- * returns 1. If there are no events in `ms` milliseconds, returns 0
+ * Returns a file descriptor that becomes readable on button interrupts
+ */
+int button_interrupt_fd(arcade_bonnet* bonnet);
+
+/*
+ * Consumes pending interrupt events, keeping the kernel timestamp of the
+ * earliest edge in `edge_time`, and reads the new button state. Returns 1 if
+ * there are changes from the last update, -1 on read error, otherwise 0
+ */
+int read_button_interrupt(arcade_bonnet* bonnet);
+
+/*
+ * Consumes interrupt events already queued, without waiting for any or reading
+ * the buttons, keeping the kernel timestamp of the earliest edge in
+ * `edge_time` (0 if there was none). Returns zero on success, and a negative
+ * value on errors
+ */
+int consume_button_interrupt(arcade_bonnet* bonnet);
+
+/*
+ * Samples the interrupt line without waiting, returns 1 if it is asserted, 0
+ * if not, and -1 on errors
+ */
+int button_interrupt_asserted(arcade_bonnet* bonnet);
+
+/*
+ * Checks for an interrupt that stayed asserted since the previous check
+ * without any read, e.g. after a failed read or a missed edge, and clears it
+ * with a read. Call it periodically. Returns 1 if a recovery read updated the
+ * state, 0 if the line is fine, -1 if the line cannot be read, and -2 if the
+ * recovery read failed. Only successful recoveries count in `recoveries`
  */
-int wait_for_button_interrupt(arcade_bonnet* bonnet, int ms);
+int recover_button_interrupt(arcade_bonnet* bonnet);
 #endif
 
 /*
@@ -0,0 +1,297 @@
+/*
+ * Serves the battery attribute directory straight from daemon memory with FUSE
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+
+#include "battery_fs.h"
+
+#define FS_NAME "GGA"
+#define FILE_BUFFER_LEN 32
+
+// Inode numbers of the served files
+#define INO_CAPACITY    2
+#define INO_STATUS      3
+
+/*
+ * Stores a new sample in `status`, stamping it with the current time
+ */
+void update_battery_status(battery_status* status,
+    double capacity, double current, int charging)
+{
+    pthread_mutex_lock(&status->lock);
+    status->capacity = capacity;
+    status->current = current;
+    status->charging = charging;
+    clock_gettime(CLOCK_MONOTONIC, &status->sampled);
+    pthread_mutex_unlock(&status->lock);
+}
+
+/*
+ * Returns the battery fraction (0.0 - 1.0) at this instant, extrapolating the
+ * last sample forward with its current
+ */
+double battery_status_percentage(battery_status* status)
+{
+    struct timespec now;
+    double hours, capacity;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&status->lock);
+    hours = ((now.tv_sec - status->sampled.tv_sec)
+        + (now.tv_nsec - status->sampled.tv_nsec) / 1e9) / 3600.0;
+    capacity = (status->capacity + status->current * hours)
+        / status->full_capacity;
+    pthread_mutex_unlock(&status->lock);
+
+    if (capacity > 1) capacity = 1.0;
+    else if (capacity < 0) capacity = 0.0;
+    return capacity;
+}
+
+#ifdef BATTERY_FUSE
+/*
+ * Private helper functions
+ */
+static const char* file_name(fuse_ino_t ino)
+{
+    switch (ino)
+    {
+        case INO_CAPACITY:
+            return "capacity";
+        case INO_STATUS:
+            return "status";
+    }
+    return NULL;
+}
+static int render_file(battery_status* status, fuse_ino_t ino, char* buf)
+{
+    int charging;
+    switch (ino)
+    {
+        case INO_CAPACITY:
+            return snprintf(buf, FILE_BUFFER_LEN, "%d\n",
+                (int)round(battery_status_percentage(status) * 100));
+        case INO_STATUS:
+            pthread_mutex_lock(&status->lock);
+            charging = status->charging;
+            pthread_mutex_unlock(&status->lock);
+            return snprintf(buf, FILE_BUFFER_LEN, "%s\n",
+                charging ? "Charging" : "Discharging");
+    }
+    return -1;
+}
+static int fill_stat(battery_status* status, fuse_ino_t ino, struct stat* st)
+{
+    char buf[FILE_BUFFER_LEN];
+    memset(st, 0, sizeof(struct stat));
+    st->st_ino = ino;
+    if (ino == FUSE_ROOT_ID)
+    {
+        st->st_mode = S_IFDIR | 0755;
+        st->st_nlink = 2;
+        return 0;
+    }
+    else if (file_name(ino))
+    {
+        st->st_mode = S_IFREG | 0444;
+        st->st_nlink = 1;
+        st->st_size = render_file(status, ino, buf);
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * FUSE operations, attributes are never cached so every read is rendered anew
+ */
+static void fs_lookup(fuse_req_t req, fuse_ino_t parent, const char* name)
+{
+    battery_status* status = fuse_req_userdata(req);
+    struct fuse_entry_param entry;
+    memset(&entry, 0, sizeof(entry));
+
+    if (parent != FUSE_ROOT_ID)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    for (fuse_ino_t ino = INO_CAPACITY; ino <= INO_STATUS; ino++)
+    {
+        if (strcmp(name, file_name(ino)) == 0)
+        {
+            entry.ino = ino;
+            fill_stat(status, ino, &entry.attr);
+            fuse_reply_entry(req, &entry);
+            return;
+        }
+    }
+    fuse_reply_err(req, ENOENT);
+}
+static void fs_getattr(fuse_req_t req, fuse_ino_t ino,
+    struct fuse_file_info* fi)
+{
+    struct stat st;
+    if (fill_stat(fuse_req_userdata(req), ino, &st) != 0)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    fuse_reply_attr(req, &st, 0.0);
+}
+static void fs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+    off_t off, struct fuse_file_info* fi)
+{
+    char buf[256];
+    size_t len = 0;
+    struct stat st;
+    const char* names[] = { ".", "..", "capacity", "status" };
+    const fuse_ino_t inos[] = {
+        FUSE_ROOT_ID, FUSE_ROOT_ID, INO_CAPACITY, INO_STATUS };
+
+    if (ino != FUSE_ROOT_ID)
+    {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+    memset(&st, 0, sizeof(st));
+    for (int i = off; i < 4; i++)
+    {
+        size_t entry;
+        st.st_ino = inos[i];
+        st.st_mode = i < 2 ? S_IFDIR : S_IFREG;
+        entry = fuse_add_direntry(req, buf + len, sizeof(buf) - len,
+            names[i], &st, i + 1);
+        if (len + entry > size || len + entry > sizeof(buf))
+        {
+            break;
+        }
+        len += entry;
+    }
+    fuse_reply_buf(req, buf, len);
+}
+static void fs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+    if (!file_name(ino))
+    {
+        fuse_reply_err(req, ENOENT);
+    }
+    else if ((fi->flags & O_ACCMODE) != O_RDONLY)
+    {
+        fuse_reply_err(req, EACCES);
+    }
+    else
+    {
+        // Bypass the page cache so each read reaches fs_read
+        fi->direct_io = 1;
+        fuse_reply_open(req, fi);
+    }
+}
+static void fs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+    struct fuse_file_info* fi)
+{
+    char buf[FILE_BUFFER_LEN];
+    int len = render_file(fuse_req_userdata(req), ino, buf);
+    if (len < 0)
+    {
+        fuse_reply_err(req, ENOENT);
+    }
+    else if (off >= len)
+    {
+        fuse_reply_buf(req, NULL, 0);
+    }
+    else
+    {
+        fuse_reply_buf(req, buf + off,
+            (size_t)(len - off) < size ? (size_t)(len - off) : size);
+    }
+}
+
+static const struct fuse_lowlevel_ops battery_fs_ops = {
+    .lookup = fs_lookup,
+    .getattr = fs_getattr,
+    .readdir = fs_readdir,
+    .open = fs_open,
+    .read = fs_read,
+};
+
+/*
+ * Mounts a read-only filesystem at `mountpoint` holding the files `capacity`
+ * and `status`, which are rendered from `status` on every read. Returns NULL
+ * on error
+ */
+battery_fs* mount_battery_fs(const char* mountpoint, battery_status* status)
+{
+    char* argv[] = { FS_NAME, "-o", "allow_other,fsname=" FS_NAME };
+    struct fuse_args args = FUSE_ARGS_INIT(3, argv);
+    battery_fs* fs = malloc(sizeof(battery_fs));
+    if (!fs)
+    {
+        return NULL;
+    }
+    memset(&fs->request, 0, sizeof(fs->request));
+    fs->status = status;
+    fs->mounted = 0;
+
+    fs->session = fuse_session_new(
+        &args, &battery_fs_ops, sizeof(battery_fs_ops), status);
+    if (!fs->session)
+    {
+        free(fs);
+        return NULL;
+    }
+    if (fuse_session_mount(fs->session, mountpoint) != 0)
+    {
+        unmount_battery_fs(fs);
+        return NULL;
+    }
+    fs->mounted = 1;
+    return fs;
+}
+
+/*
+ * Returns the file descriptor that becomes readable when a request is pending
+ */
+int battery_fs_fd(battery_fs* fs)
+{
+    return fuse_session_fd(fs->session);
+}
+
+/*
+ * Reads and answers one pending request, returns zero on success, and a
+ * negative value once the filesystem has been unmounted or on errors
+ */
+int process_battery_fs(battery_fs* fs)
+{
+    int ret = fuse_session_receive_buf(fs->session, &fs->request);
+    if (ret == -EINTR || ret == -EAGAIN)
+    {
+        return 0;
+    }
+    else if (ret <= 0)
+    {
+        return -1;
+    }
+    fuse_session_process_buf(fs->session, &fs->request);
+    return 0;
+}
+
+/*
+ * Unmounts the filesystem and frees memory
+ */
+void unmount_battery_fs(battery_fs* fs)
+{
+    if (fs->mounted)
+    {
+        fuse_session_unmount(fs->session);
+    }
+    fuse_session_destroy(fs->session);
+    free(fs->request.mem);
+    free(fs);
+}
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Serves the battery attribute directory straight from daemon memory with FUSE
+ */
+
+#ifndef BATTERY_FS_H
+#define BATTERY_FS_H
+
+#include <pthread.h>
+#include <time.h>
+
+#ifdef BATTERY_FUSE
+#include <fuse_lowlevel.h>
+#endif
+
+/*
+ * Latest battery sample shared between the sampling loop and the readers
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    double capacity;            // Remaining capacity in mAh when sampled
+    double full_capacity;       // Capacity of a full battery in mAh
+    double current;             // Current in mA when sampled, + is charging
+    int charging;
+    struct timespec sampled;    // CLOCK_MONOTONIC time of the last sample
+} battery_status;
+
+/*
+ * Stores a new sample in `status`, stamping it with the current time
+ */
+void update_battery_status(battery_status* status,
+    double capacity, double current, int charging);
+
+/*
+ * Returns the battery fraction (0.0 - 1.0) at this instant, extrapolating the
+ * last sample forward with its current
+ */
+double battery_status_percentage(battery_status* status);
+
+#ifdef BATTERY_FUSE
+typedef struct {
+    struct fuse_session* session;
+    struct fuse_buf request;
+    battery_status* status;
+    int mounted;
+} battery_fs;
+
+/*
+ * Mounts a read-only filesystem at `mountpoint` holding the files `capacity`
+ * and `status`, which are rendered from `status` on every read. Returns NULL
+ * on error
+ */
+battery_fs* mount_battery_fs(const char* mountpoint, battery_status* status);
+
+/*
+ * Returns the file descriptor that becomes readable when a request is pending
+ */
+int battery_fs_fd(battery_fs* fs);
+
+/*
+ * Reads and answers one pending request, returns zero on success, and a
+ * negative value once the filesystem has been unmounted or on errors
+ */
+int process_battery_fs(battery_fs* fs);
+
+/*
+ * Unmounts the filesystem and frees memory
+ */
+void unmount_battery_fs(battery_fs* fs);
+#endif
+
+#endif
@@ -4,13 +4,8 @@
 
 #include <stdlib.h>
 
-// Needed for i2c bus
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
-#include <linux/i2c.h>
-
 #include "battery_gauge.h"
+#include "i2c_bus.h"
 
 // Register values
 #define REG_CONFIG          0x00
@@ -28,38 +23,20 @@
 /*
  * Private helper functions
  */
-int i2c_write_word(int bus, uint8_t reg, uint16_t value)
+static int i2c_write_word(ina219_config* chip, uint8_t reg, uint16_t value)
 {
-    struct i2c_smbus_ioctl_data args;
-    union i2c_smbus_data data;
-    int err;
-    args.read_write = I2C_SMBUS_WRITE;
-    args.command = reg;
-    args.size = I2C_SMBUS_WORD_DATA;
-    args.data = &data;
-    data.word = ((value & 0x00FF) << 8) | ((value & 0xFF00) >> 8);
-
-    if (ioctl(bus, I2C_SMBUS, &args) < 0)
-    {
-        return -1;
-    }
-    return 0;
+    // Registers are big endian
+    uint8_t buf[3] = { reg, value >> 8, value & 0xFF };
+    return i2c_transfer(chip->i2c_bus, chip->addr, buf, 3, NULL, 0);
 }
-int i2c_read_word(int bus, uint8_t reg)
+static int i2c_read_word(ina219_config* chip, uint8_t reg)
 {
-    struct i2c_smbus_ioctl_data args;
-    union i2c_smbus_data data;
-    int err;
-    args.read_write = I2C_SMBUS_READ;
-    args.command = reg;
-    args.size = I2C_SMBUS_WORD_DATA;
-    args.data = &data;
-
-    if (ioctl(bus, I2C_SMBUS, &args) < 0)
+    uint8_t buf[2];
+    if (i2c_transfer(chip->i2c_bus, chip->addr, &reg, 1, buf, 2) < 0)
     {
         return -1;
     }
-    return ((data.word & 0x00FF) << 8) | ((data.word & 0xFF00) >> 8);
+    return (buf[0] << 8) | buf[1];
 }
 
 /*
@@ -69,7 +46,7 @@ int configure_ina219(ina219_config* chip)
 {
     uint16_t config_data = 0;
     // Set calibration register
-    if (i2c_write_word(chip->i2c_bus, REG_CALIBRATION, chip->cal_value) < 0)
+    if (i2c_write_word(chip, REG_CALIBRATION, chip->cal_value) < 0)
     {
         return -1;
     }
@@ -80,7 +57,7 @@ int configure_ina219(ina219_config* chip)
         | (BUS_ADC_RESOLUTION << 7)
         | (SHUNT_ADC_RESOLUTION << 3)
         | INA219_MODE;
-    if (i2c_write_word(chip->i2c_bus, REG_CONFIG, config_data) < 0)
+    if (i2c_write_word(chip, REG_CONFIG, config_data) < 0)
     {
         return -2;
     }
@@ -122,14 +99,11 @@ ina219_config* initialize_ina219(long addr, char* bus, uint8_t bus_voltage_range
         return NULL;
     }
 
-    chip->i2c_bus = open(bus, O_RDWR);
+    chip->addr = addr;
+    chip->i2c_bus = open_i2c_device(bus, addr);
     if (chip->i2c_bus < 0)
     {
-        return NULL;
-    }
-    else if (ioctl(chip->i2c_bus, I2C_SLAVE, addr))
-    {
-        close_ina219(chip);
+        free(chip);
         return NULL;
     }
 
@@ -150,13 +124,13 @@ double get_shunt_voltage(ina219_config* chip)
 {
     int val;
     // Write calibration register
-    if (i2c_write_word(chip->i2c_bus, REG_CALIBRATION, chip->cal_value) < 0)
+    if (i2c_write_word(chip, REG_CALIBRATION, chip->cal_value) < 0)
     {
         return -255.0;
     }
 
     // Read voltage value
-    val = i2c_read_word(chip->i2c_bus, REG_SHUNTVOLTAGE);
+    val = i2c_read_word(chip, REG_SHUNTVOLTAGE);
     if (val > 32767) val -= 65535;
     return val * 0.00001;
 }
@@ -168,13 +142,13 @@ double get_bus_voltage(ina219_config* chip)
 {
     int val;
     // Write calibration register
-    if (i2c_write_word(chip->i2c_bus, REG_CALIBRATION, chip->cal_value) < 0)
+    if (i2c_write_word(chip, REG_CALIBRATION, chip->cal_value) < 0)
     {
         return -255.0;
     }
 
     // Read voltage value
-    val = i2c_read_word(chip->i2c_bus, REG_BUSVOLTAGE);
+    val = i2c_read_word(chip, REG_BUSVOLTAGE);
     return (val >> 3) * 0.004;
 }
 
@@ -185,13 +159,13 @@ double get_current(ina219_config* chip)
 {
     int val;
     // Write calibration register
-    if (i2c_write_word(chip->i2c_bus, REG_CALIBRATION, chip->cal_value) < 0)
+    if (i2c_write_word(chip, REG_CALIBRATION, chip->cal_value) < 0)
     {
         return -255.0;
     }
 
     // Read current value
-    val = i2c_read_word(chip->i2c_bus, REG_CURRENT);
+    val = i2c_read_word(chip, REG_CURRENT);
     if (val > 32767) val -= 65535;
     return val * chip->current_lsb;
 }
@@ -203,13 +177,13 @@ double get_power(ina219_config* chip)
 {
     int val;
     // Write calibration register
-    if (i2c_write_word(chip->i2c_bus, REG_CALIBRATION, chip->cal_value) < 0)
+    if (i2c_write_word(chip, REG_CALIBRATION, chip->cal_value) < 0)
     {
         return -255.0;
     }
 
     // Read power value
-    val = i2c_read_word(chip->i2c_bus, REG_POWER);
+    val = i2c_read_word(chip, REG_POWER);
     if (val > 32767) val -= 65535;
     return val * chip->power_lsb;
 }
@@ -232,6 +206,6 @@ double estimate_battery_percentage(
  */
 void close_ina219(ina219_config* chip)
 {
-    close(chip->i2c_bus);
+    close_i2c_device(chip->i2c_bus);
     free(chip);
 }
@@ -24,6 +24,7 @@
 typedef struct
 {
     int i2c_bus;
+    uint16_t addr;
     uint16_t cal_value;
     uint16_t bus_voltage;
     uint16_t gain;
@@ -0,0 +1,86 @@
+/*
+ * Implements adaptive polling of the arcade bonnet for builds without the
+ * GPIO interrupt, fast after activity and slow once the buttons are idle
+ */
+
+#include <string.h>
+
+#include "button_poll.h"
+
+// Inputs are pulled up, any of these bits cleared is a held button
+static const uint16_t WIRED_BUTTONS = BUTTON_1A | BUTTON_1B | BUTTON_1C
+    | BUTTON_1D | BUTTON_1E | BUTTON_1F | PAD_DOWN | PAD_UP | PAD_RIGHT
+    | PAD_LEFT | STICK_RIGHT | STICK_LEFT | STICK_DOWN | STICK_UP;
+
+/*
+ * Sets up `poller` reading every `fast_ms` after activity, and every `slow_ms`
+ * once nothing changed or was held for `idle_ms`. Returns the deadline of the
+ * first read, `now` (CLOCK_MONOTONIC ns)
+ */
+uint64_t init_button_poller(button_poller* poller, unsigned int fast_ms,
+    unsigned int slow_ms, unsigned int idle_ms, uint64_t now)
+{
+    memset(poller, 0, sizeof(button_poller));
+    poller->fast_period = (fast_ms ? fast_ms : 1) * 1000000ULL;
+    poller->slow_period = slow_ms * 1000000ULL;
+    if (poller->slow_period < poller->fast_period)
+    {
+        poller->slow_period = poller->fast_period;
+    }
+    poller->idle_after = idle_ms * 1000000ULL;
+    poller->last_active = now;
+    poller->last_read = now;
+    poller->next_read = now;
+    poller->window_start = now;
+    reset_histogram(&poller->detection);
+    return now;
+}
+
+/*
+ * Records a read at `now` that found `state`, and whether it `changed`.
+ * Returns the deadline of the next read
+ */
+uint64_t button_poll_step(button_poller* poller, arcade_buttons state,
+    int changed, uint64_t now)
+{
+    uint64_t period = poller->slow_period;
+    poller->reads++;
+    poller->window_reads++;
+    if (changed)
+    {
+        // The change happened at some point since the previous read
+        histogram_add(&poller->detection, now - poller->last_read);
+    }
+    if (changed || (~state & WIRED_BUTTONS))
+    {
+        poller->last_active = now;
+    }
+    poller->last_read = now;
+
+    if (now - poller->last_active < poller->idle_after)
+    {
+        period = poller->fast_period;
+        poller->fast_reads++;
+    }
+    // A change switches to the fast period from this read on, reads missed
+    // by a late timer are skipped rather than made up
+    poller->next_read += period;
+    if (poller->next_read <= now) poller->next_read = now + period;
+    return poller->next_read;
+}
+
+/*
+ * Returns the reads per second since the previous call at `now`, or since
+ * polling started
+ */
+double button_poll_rate(button_poller* poller, uint64_t now)
+{
+    double rate = 0;
+    if (now > poller->window_start)
+    {
+        rate = poller->window_reads * 1e9 / (now - poller->window_start);
+    }
+    poller->window_reads = 0;
+    poller->window_start = now;
+    return rate;
+}
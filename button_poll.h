@@ -0,0 +1,49 @@
+/*
+ * Implements adaptive polling of the arcade bonnet for builds without the
+ * GPIO interrupt, fast after activity and slow once the buttons are idle
+ */
+
+#ifndef BUTTON_POLL_H
+#define BUTTON_POLL_H
+
+#include <stdint.h>
+
+#include "arcade_buttons.h"
+#include "histogram.h"
+
+typedef struct {
+    uint64_t fast_period;       // ns between reads while active
+    uint64_t slow_period;       // ns between reads while idle
+    uint64_t idle_after;        // ns without changes or held buttons to slow
+    uint64_t last_active;       // Time of the last change or held button
+    uint64_t last_read;
+    uint64_t next_read;         // Deadline of the next read
+    unsigned long reads;
+    unsigned long fast_reads;
+    unsigned long window_reads; // Reads counted by `button_poll_rate`
+    uint64_t window_start;
+    histogram detection;        // Time between the reads around each change
+} button_poller;
+
+/*
+ * Sets up `poller` reading every `fast_ms` after activity, and every `slow_ms`
+ * once nothing changed or was held for `idle_ms`. Returns the deadline of the
+ * first read, `now` (CLOCK_MONOTONIC ns)
+ */
+uint64_t init_button_poller(button_poller* poller, unsigned int fast_ms,
+    unsigned int slow_ms, unsigned int idle_ms, uint64_t now);
+
+/*
+ * Records a read at `now` that found `state`, and whether it `changed`.
+ * Returns the deadline of the next read
+ */
+uint64_t button_poll_step(button_poller* poller, arcade_buttons state,
+    int changed, uint64_t now);
+
+/*
+ * Returns the reads per second since the previous call at `now`, or since
+ * polling started
+ */
+double button_poll_rate(button_poller* poller, uint64_t now);
+
+#endif
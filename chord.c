@@ -0,0 +1,301 @@
+/*
+ * Implements chords and layer shift buttons in front of the keymap
+ */
+
+#include <string.h>
+
+#include "chord.h"
+#include "config.h"
+
+/*
+ * Private helper functions
+ */
+static void record_decision(chord_engine* engine, uint64_t now)
+{
+    uint64_t held_back = now - engine->pending_since;
+    histogram_add(&engine->decision, held_back);
+    if (held_back > engine->budget) engine->over_budget++;
+}
+
+static int append_chord(chord_engine* engine, const char* buttons,
+    const keymap_entry* outputs, int command)
+{
+    char buf[CONFIG_LINE_LEN], *name, *save;
+    chord* added = &engine->chords[engine->count];
+    if (engine->count == CHORD_MAX)
+    {
+        return -1;
+    }
+
+    added->buttons = 0;
+    strncpy(buf, buttons, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    for (name = strtok_r(buf, "+", &save); name;
+        name = strtok_r(NULL, "+", &save))
+    {
+        int index = keymap_button_index(name);
+        if (index < 0)
+        {
+            return -2;
+        }
+        added->buttons |= 1 << index;
+    }
+    // A chord needs two buttons, a single one belongs in the keymap
+    if (__builtin_popcount(added->buttons) < 2)
+    {
+        return -2;
+    }
+    added->outputs = *outputs;
+    added->command = command;
+
+    // Precompute the lookups done on each press
+    engine->members |= added->buttons;
+    for (int i = 0; i < KEYMAP_BUTTONS; i++)
+    {
+        if (added->buttons & (1 << i))
+        {
+            engine->by_button[i] |= 1 << engine->count;
+        }
+    }
+    engine->count++;
+    return 0;
+}
+
+/*
+ * Sets up `engine` without chords
+ */
+void init_chord_engine(chord_engine* engine)
+{
+    memset(engine, 0, sizeof(chord_engine));
+    reset_histogram(&engine->decision);
+}
+
+/*
+ * Holds member presses back for at most `window_ms`, within a latency budget
+ * of `budget_ms`. Returns zero on success, and a negative value if the window
+ * does not fit the budget
+ */
+int set_chord_window(chord_engine* engine, unsigned int window_ms,
+    unsigned int budget_ms)
+{
+    if (window_ms > budget_ms)
+    {
+        return -1;
+    }
+    engine->window = window_ms * 1000000ULL;
+    engine->budget = budget_ms * 1000000ULL;
+    return 0;
+}
+
+/*
+ * Adds a chord of the '+' separated buttons in `buttons` (BUTTON_1A+BUTTON_1B)
+ * sending the keys in `value`. Returns zero on success, and a negative value
+ * on an unknown button or key, or if there are too many chords
+ */
+int add_chord(chord_engine* engine, const char* buttons, const char* value)
+{
+    keymap_entry outputs;
+    if (parse_keymap_entry(value, &outputs) != 0)
+    {
+        return -3;
+    }
+    for (unsigned int i = 0; i < outputs.count; i++)
+    {
+        if (outputs.outputs[i].type != EV_KEY)
+        {
+            return -3;
+        }
+    }
+    return append_chord(engine, buttons, &outputs, -1);
+}
+
+/*
+ * Adds a chord of the '+' separated buttons in `buttons` that runs command
+ * `command`. Returns zero on success, and a negative value on an unknown
+ * button, or if there are too many chords
+ */
+int add_chord_command(chord_engine* engine, const char* buttons, int command)
+{
+    keymap_entry outputs = { 0 };
+    return append_chord(engine, buttons, &outputs, command);
+}
+
+/*
+ * Makes the whitespace separated buttons in `value` layer shifts. A shift is
+ * held back until released instead of for the window, and only passed on as a
+ * tap if nothing else was pressed meanwhile. It only sends the chords it is
+ * part of, other buttons keep their keys while it is held. Returns zero on
+ * success, and a negative value on an unknown button
+ */
+int set_chord_shifts(chord_engine* engine, const char* value)
+{
+    char buf[CONFIG_LINE_LEN], *names[KEYMAP_BUTTONS];
+    int count;
+    strncpy(buf, value, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    count = split_config_value(buf, names, KEYMAP_BUTTONS);
+    if (count < 0)
+    {
+        return -1;
+    }
+
+    engine->shifts = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int index = keymap_button_index(names[i]);
+        if (index < 0)
+        {
+            return -1;
+        }
+        engine->shifts |= 1 << index;
+    }
+    return 0;
+}
+
+/*
+ * Returns the shift buttons that are not part of any chord, which would act
+ * as plain buttons. Check it once every chord is added
+ */
+uint16_t unchorded_shifts(const chord_engine* engine)
+{
+    return engine->shifts & ~engine->members;
+}
+
+/*
+ * Lets `device` send every key used by the chords, returns zero on success,
+ * and a negative value on errors
+ */
+int enable_chord_outputs(const chord_engine* engine, input_device* device)
+{
+    for (int c = 0; c < engine->count; c++)
+    {
+        const keymap_entry* outputs = &engine->chords[c].outputs;
+        for (unsigned int i = 0; i < outputs->count; i++)
+        {
+            if (enable_device_key(device, outputs->outputs[i].code) != 0)
+            {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Feeds the debounced `state` at `now` (CLOCK_MONOTONIC ns), filling `result`
+ * with the states to pass to the keymap and the chords that changed. Call it
+ * again with the same state once `chord_deadline` passes
+ */
+void chord_update(chord_engine* engine, arcade_buttons state, uint64_t now,
+    chord_result* result)
+{
+    // Inputs are pulled up, a cleared bit is a pressed button
+    uint16_t held = ~state, pressed, released, others, taps = 0;
+    uint16_t candidates = 0, shifts = engine->shifts & engine->members;
+    pressed = held & ~engine->held;
+    released = engine->held & ~held;
+    engine->held = held;
+    result->pressed = 0;
+    result->released = 0;
+
+    if (released & (engine->pending | engine->consumed))
+    {
+        // A release inside the window, or of an unused shift, is a tap
+        taps = released & (engine->pending
+            | (engine->consumed & shifts & ~engine->used_shifts));
+        if (released & engine->pending) record_decision(engine, now);
+        for (uint16_t active = engine->active; active; active &= active - 1)
+        {
+            int c = __builtin_ctz(active);
+            if (engine->chords[c].buttons & released)
+            {
+                engine->active &= ~(1 << c);
+                result->released |= 1 << c;
+            }
+        }
+        engine->pending &= ~released;
+        engine->consumed &= ~released;
+        engine->used_shifts &= ~released;
+    }
+
+    // Only chords containing a new press can complete now, and only if none
+    // of their buttons already reached the keymap
+    for (uint16_t bits = pressed & engine->members; bits; bits &= bits - 1)
+    {
+        candidates |= engine->by_button[__builtin_ctz(bits)];
+    }
+    for (; candidates; candidates &= candidates - 1)
+    {
+        int c = __builtin_ctz(candidates);
+        uint16_t buttons = engine->chords[c].buttons;
+        if ((held & buttons) != buttons || (engine->active & (1 << c))
+            || (buttons & ~(engine->pending | engine->consumed | pressed)))
+        {
+            continue;
+        }
+        if (buttons & engine->pending) record_decision(engine, now);
+        engine->active |= 1 << c;
+        engine->consumed |= buttons;
+        engine->pending &= ~buttons;
+        engine->used_shifts |= buttons & shifts;
+        result->pressed |= 1 << c;
+    }
+
+    // Remaining member presses wait for the rest of a chord, a shift held
+    // while anything else is pressed acted as a modifier
+    others = pressed & ~shifts;
+    pressed &= engine->members & ~engine->consumed;
+    engine->consumed |= pressed & shifts;
+    if (others) engine->used_shifts |= engine->consumed & shifts;
+    if (pressed & ~shifts)
+    {
+        if (!engine->pending) engine->pending_since = now;
+        engine->pending |= pressed & ~shifts;
+    }
+    if (engine->pending && now >= engine->pending_since + engine->window)
+    {
+        record_decision(engine, now);
+        engine->pending = 0;
+    }
+
+    // Held back buttons look released to the keymap
+    state |= engine->pending | engine->consumed;
+    result->state_count = 0;
+    if (taps)
+    {
+        result->states[result->state_count++] = state & ~taps;
+    }
+    result->states[result->state_count++] = state;
+}
+
+/*
+ * Returns the time held back presses are released, or 0 if there are none
+ */
+uint64_t chord_deadline(const chord_engine* engine)
+{
+    return engine->pending ? engine->pending_since + engine->window : 0;
+}
+
+/*
+ * Writes the key events of the chords in `pressed` and `released` to `events`,
+ * which must hold KEYMAP_MAX_EVENTS entries. Returns the number written
+ */
+int chord_events(const chord_engine* engine, uint16_t pressed,
+    uint16_t released, device_event* events)
+{
+    uint16_t changed = pressed | released;
+    int count = 0;
+    for (; changed; changed &= changed - 1)
+    {
+        int c = __builtin_ctz(changed);
+        const keymap_entry* outputs = &engine->chords[c].outputs;
+        for (unsigned int i = 0; i < outputs->count; i++)
+        {
+            events[count].type = EV_KEY;
+            events[count].code = outputs->outputs[i].code;
+            events[count].value = (pressed >> c) & 1;
+            count++;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,125 @@
+/*
+ * Implements chords and layer shift buttons in front of the keymap
+ */
+
+#ifndef CHORD_H
+#define CHORD_H
+
+#include <stdint.h>
+
+#include "arcade_buttons.h"
+#include "histogram.h"
+#include "input_device.h"
+#include "keymap.h"
+
+#define CHORD_MAX 16
+
+/*
+ * Keys held while every button of `buttons` is, and a command run when they
+ * all go down
+ */
+typedef struct {
+    uint16_t buttons;
+    keymap_entry outputs;
+    int command;                // Command index, -1 for none
+} chord;
+
+typedef struct {
+    uint64_t window;            // ns a press may be held back for a chord
+    uint64_t budget;            // ns a press may be held back in the worst case
+    uint16_t members;           // Buttons that are part of any chord
+    uint16_t shifts;            // Layer shift buttons, held back until released
+    uint16_t by_button[KEYMAP_BUTTONS]; // Chords each button is part of
+    int count;
+    chord chords[CHORD_MAX];
+
+    uint16_t held;              // Buttons physically held
+    uint16_t pending;           // Presses held back within the window
+    uint16_t consumed;          // Presses taken by a chord or shift
+    uint16_t used_shifts;       // Shifts held while another button was pressed
+    uint16_t active;            // Chords held, bits index `chords`
+    uint64_t pending_since;
+    histogram decision;         // Time presses were held back for
+    unsigned long over_budget;  // Decisions that took longer than `budget`
+} chord_engine;
+
+/*
+ * What one update produced, the button states to pass on in order and the
+ * chords that went down or up, with bits indexing `chords`
+ */
+typedef struct {
+    int state_count;
+    arcade_buttons states[2];
+    uint16_t pressed;
+    uint16_t released;
+} chord_result;
+
+/*
+ * Sets up `engine` without chords
+ */
+void init_chord_engine(chord_engine* engine);
+
+/*
+ * Holds member presses back for at most `window_ms`, within a latency budget
+ * of `budget_ms`. Returns zero on success, and a negative value if the window
+ * does not fit the budget
+ */
+int set_chord_window(chord_engine* engine, unsigned int window_ms,
+    unsigned int budget_ms);
+
+/*
+ * Adds a chord of the '+' separated buttons in `buttons` (BUTTON_1A+BUTTON_1B)
+ * sending the keys in `value`. Returns zero on success, and a negative value
+ * on an unknown button or key, or if there are too many chords
+ */
+int add_chord(chord_engine* engine, const char* buttons, const char* value);
+
+/*
+ * Adds a chord of the '+' separated buttons in `buttons` that runs command
+ * `command`. Returns zero on success, and a negative value on an unknown
+ * button, or if there are too many chords
+ */
+int add_chord_command(chord_engine* engine, const char* buttons, int command);
+
+/*
+ * Makes the whitespace separated buttons in `value` layer shifts. A shift is
+ * held back until released instead of for the window, and only passed on as a
+ * tap if nothing else was pressed meanwhile. It only sends the chords it is
+ * part of, other buttons keep their keys while it is held. Returns zero on
+ * success, and a negative value on an unknown button
+ */
+int set_chord_shifts(chord_engine* engine, const char* value);
+
+/*
+ * Returns the shift buttons that are not part of any chord, which would act
+ * as plain buttons. Check it once every chord is added
+ */
+uint16_t unchorded_shifts(const chord_engine* engine);
+
+/*
+ * Lets `device` send every key used by the chords, returns zero on success,
+ * and a negative value on errors
+ */
+int enable_chord_outputs(const chord_engine* engine, input_device* device);
+
+/*
+ * Feeds the debounced `state` at `now` (CLOCK_MONOTONIC ns), filling `result`
+ * with the states to pass to the keymap and the chords that changed. Call it
+ * again with the same state once `chord_deadline` passes
+ */
+void chord_update(chord_engine* engine, arcade_buttons state, uint64_t now,
+    chord_result* result);
+
+/*
+ * Returns the time held back presses are released, or 0 if there are none
+ */
+uint64_t chord_deadline(const chord_engine* engine);
+
+/*
+ * Writes the key events of the chords in `pressed` and `released` to `events`,
+ * which must hold KEYMAP_MAX_EVENTS entries. Returns the number written
+ */
+int chord_events(const chord_engine* engine, uint16_t pressed,
+    uint16_t released, device_event* events);
+
+#endif
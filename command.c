@@ -0,0 +1,242 @@
+/*
+ * Implements shell commands bound to hotkeys, spawned off the input path
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "command.h"
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+// The worker only polls and spawns, a small stack stays cheap when the
+// daemon locks its memory
+#define WORKER_STACK_SIZE (PTHREAD_STACK_MIN + 64 * 1024)
+
+extern char** environ;
+
+/*
+ * Private helper functions
+ */
+static pid_t spawn_command(const char* line)
+{
+    char* argv[] = { COMMAND_SHELL, "-c", (char*)line, NULL };
+    posix_spawnattr_t attr;
+    sigset_t signals;
+    pid_t pid;
+    int ret;
+
+    // Threads inherit the signals the event loop blocked, children must not
+    posix_spawnattr_init(&attr);
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigfillset(&signals);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK
+        | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSID);
+    ret = posix_spawn(&pid, COMMAND_SHELL, NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    return ret == 0 ? pid : -1;
+}
+
+static void* command_worker(void* data)
+{
+    command_runner* runner = data;
+    struct pollfd fds[COMMAND_MAX_RUNNING + 1];
+    int running = 0;
+    fds[0].fd = runner->queue[0];
+    fds[0].events = POLLIN;
+
+    for (;;)
+    {
+        // Stop taking requests while the children limit is reached, the
+        // queue is still polled so its closing ends the worker
+        int n;
+        fds[0].events = running == COMMAND_MAX_RUNNING ? 0 : POLLIN;
+        n = poll(fds, running + 1, -1);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n < 0)
+        {
+            break;
+        }
+
+        // Reap exited children through their pidfds
+        for (int i = 1; i <= running; i++)
+        {
+            siginfo_t info;
+            if (!(fds[i].revents & POLLIN))
+            {
+                continue;
+            }
+            waitid(P_PIDFD, fds[i].fd, &info, WEXITED | WNOHANG);
+            close(fds[i].fd);
+            fds[i--] = fds[running--];
+            __atomic_fetch_add(&runner->exited, 1, __ATOMIC_RELAXED);
+        }
+
+        // The loop closed its end, the queue is drained
+        if ((fds[0].revents & (POLLHUP | POLLIN)) == POLLHUP)
+        {
+            break;
+        }
+        if (running < COMMAND_MAX_RUNNING && (fds[0].revents & POLLIN))
+        {
+            unsigned char index;
+            pid_t pid;
+            int pidfd;
+            if (read(runner->queue[0], &index, 1) != 1)
+            {
+                break;
+            }
+            pid = spawn_command(runner->lines[index]);
+            pidfd = pid > 0 ? syscall(SYS_pidfd_open, pid, 0) : -1;
+            if (pid <= 0)
+            {
+                __atomic_fetch_add(&runner->failed, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            if (pidfd < 0)
+            {
+                // Out of descriptors, a child that cannot be reaped later is
+                // stopped at once, which makes the wait immediate
+                kill(pid, SIGKILL);
+                waitpid(pid, NULL, 0);
+                __atomic_fetch_add(&runner->failed, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            __atomic_fetch_add(&runner->spawned, 1, __ATOMIC_RELAXED);
+            running++;
+            fds[running].fd = pidfd;
+            fds[running].events = POLLIN;
+            fds[running].revents = 0;
+        }
+        fds[0].revents = 0;
+    }
+
+    for (int i = 1; i <= running; i++)
+    {
+        close(fds[i].fd);
+    }
+    return NULL;
+}
+
+/*
+ * Sets up `runner` without commands
+ */
+void init_command_runner(command_runner* runner)
+{
+    memset(runner, 0, sizeof(command_runner));
+    runner->interval = COMMAND_INTERVAL * 1000000ULL;
+    runner->queue[0] = -1;
+    runner->queue[1] = -1;
+}
+
+/*
+ * Adds the shell command `line`, returns its index, or a negative value if
+ * there are too many
+ */
+int add_command(command_runner* runner, const char* line)
+{
+    if (runner->count == COMMAND_MAX)
+    {
+        return -1;
+    }
+    runner->lines[runner->count] = strdup(line);
+    if (!runner->lines[runner->count])
+    {
+        return -2;
+    }
+    return runner->count++;
+}
+
+/*
+ * Starts the worker that spawns and reaps commands, returns zero on success,
+ * -3 if the kernel has no pidfds to reap them through, and another negative
+ * value on other errors
+ */
+int start_command_runner(command_runner* runner)
+{
+    pthread_attr_t attr;
+    int ret, pidfd = syscall(SYS_pidfd_open, getpid(), 0);
+    // Children are only reaped through pidfds, never with a blocking wait
+    if (pidfd < 0 && errno == ENOSYS)
+    {
+        return -3;
+    }
+    if (pidfd >= 0) close(pidfd);
+    if (pipe2(runner->queue, O_CLOEXEC) != 0)
+    {
+        return -1;
+    }
+    // The loop side never waits, a full queue drops the request
+    fcntl(runner->queue[1], F_SETFL, O_NONBLOCK);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+    ret = pthread_create(&runner->worker, &attr, command_worker, runner);
+    pthread_attr_destroy(&attr);
+    if (ret != 0)
+    {
+        return -2;
+    }
+    runner->started = 1;
+    return 0;
+}
+
+/*
+ * Hands command `index` to the worker without blocking. Returns zero if it was
+ * queued, and a negative value if it ran less than the interval before `now`
+ * (CLOCK_MONOTONIC ns) or the queue is full
+ */
+int run_command(command_runner* runner, int index, uint64_t now)
+{
+    unsigned char request = index;
+    if (runner->last_run[index]
+        && now - runner->last_run[index] < runner->interval)
+    {
+        runner->limited++;
+        return -1;
+    }
+    if (write(runner->queue[1], &request, 1) != 1)
+    {
+        runner->limited++;
+        return -2;
+    }
+    runner->last_run[index] = now;
+    runner->queued++;
+    return 0;
+}
+
+/*
+ * Stops the worker and frees the commands, running children are left to finish
+ */
+void close_command_runner(command_runner* runner)
+{
+    if (runner->queue[1] >= 0) close(runner->queue[1]);
+    if (runner->started) pthread_join(runner->worker, NULL);
+    if (runner->queue[0] >= 0) close(runner->queue[0]);
+    for (int i = 0; i < runner->count; i++)
+    {
+        free(runner->lines[i]);
+    }
+    runner->count = 0;
+    runner->started = 0;
+    runner->queue[0] = -1;
+    runner->queue[1] = -1;
+}
@@ -0,0 +1,61 @@
+/*
+ * Implements shell commands bound to hotkeys, spawned off the input path
+ */
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define COMMAND_MAX         16
+#define COMMAND_MAX_RUNNING 4
+#define COMMAND_INTERVAL    250     // ms
+#define COMMAND_SHELL       "/bin/sh"
+
+typedef struct {
+    int count;
+    char* lines[COMMAND_MAX];           // Run with `sh -c`
+    uint64_t last_run[COMMAND_MAX];     // CLOCK_MONOTONIC ns
+    uint64_t interval;                  // Minimum ns between runs of one line
+    int queue[2];                       // Pipe of line indices to the worker
+    pthread_t worker;
+    int started;
+    unsigned long queued;
+    unsigned long limited;              // Dropped by the rate limit
+    unsigned long spawned;              // Updated by the worker
+    unsigned long failed;               // Updated by the worker
+    unsigned long exited;               // Updated by the worker
+} command_runner;
+
+/*
+ * Sets up `runner` without commands
+ */
+void init_command_runner(command_runner* runner);
+
+/*
+ * Adds the shell command `line`, returns its index, or a negative value if
+ * there are too many
+ */
+int add_command(command_runner* runner, const char* line);
+
+/*
+ * Starts the worker that spawns and reaps commands, returns zero on success,
+ * -3 if the kernel has no pidfds to reap them through, and another negative
+ * value on other errors
+ */
+int start_command_runner(command_runner* runner);
+
+/*
+ * Hands command `index` to the worker without blocking. Returns zero if it was
+ * queued, and a negative value if it ran less than the interval before `now`
+ * (CLOCK_MONOTONIC ns) or the queue is full
+ */
+int run_command(command_runner* runner, int index, uint64_t now);
+
+/*
+ * Stops the worker and frees the commands, running children are left to finish
+ */
+void close_command_runner(command_runner* runner);
+
+#endif
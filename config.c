@@ -0,0 +1,153 @@
+/*
+ * Implements a parser for INI style configuration files
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "config.h"
+
+/*
+ * Private helper functions
+ */
+static char* trim(char* str)
+{
+    char* end;
+    while (isspace((unsigned char)*str)) str++;
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return str;
+}
+
+/*
+ * Reads the file at `path`, passing each entry to `handler`. Text after a '#'
+ * and blank lines are ignored. Returns zero on success, -1 if the file cannot
+ * be opened, and the line number of the first rejected line otherwise
+ */
+int parse_config_file(const char* path, config_handler handler, void* data)
+{
+    char line[CONFIG_LINE_LEN], section[CONFIG_LINE_LEN] = "";
+    int number = 0;
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file))
+    {
+        char *entry, *split = strchr(line, '#');
+        number++;
+        if (split) *split = '\0';
+        entry = trim(line);
+        if (entry[0] == '\0')
+        {
+            continue;
+        }
+        else if (entry[0] == '[')
+        {
+            split = strchr(entry, ']');
+            if (!split)
+            {
+                fclose(file);
+                return number;
+            }
+            *split = '\0';
+            strcpy(section, trim(entry + 1));
+            continue;
+        }
+
+        split = strchr(entry, '=');
+        if (!split)
+        {
+            fclose(file);
+            return number;
+        }
+        *split = '\0';
+        if (handler(section, trim(entry), trim(split + 1), data) != 0)
+        {
+            fclose(file);
+            return number;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+/*
+ * Splits `value` on whitespace into at most `max` tokens, which point into the
+ * modified string. Returns the number of tokens found, or -1 if there are more
+ * than `max`
+ */
+int split_config_value(char* value, char** tokens, int max)
+{
+    int count = 0;
+    char* save = NULL;
+    for (char* token = strtok_r(value, " \t", &save); token;
+        token = strtok_r(NULL, " \t", &save))
+    {
+        if (count == max)
+        {
+            return -1;
+        }
+        tokens[count++] = token;
+    }
+    return count;
+}
+
+/*
+ * Parses a non-negative decimal integer, or a hexadecimal one with a 0x
+ * prefix, into `out`. Returns zero on success and a negative value if `value`
+ * is not one
+ */
+int parse_config_uint(const char* value, unsigned int* out)
+{
+    char* end;
+    unsigned long parsed;
+    if (!isdigit((unsigned char)value[0]))
+    {
+        return -1;
+    }
+    if (value[0] == '0' && (value[1] == 'x' || value[1] == 'X'))
+    {
+        if (!isxdigit((unsigned char)value[2]))
+        {
+            return -1;
+        }
+        parsed = strtoul(value + 2, &end, 16);
+    }
+    else
+    {
+        parsed = strtoul(value, &end, 10);
+    }
+    if (*end != '\0' || parsed > 0xFFFFFFFFUL)
+    {
+        return -1;
+    }
+    *out = parsed;
+    return 0;
+}
+
+/*
+ * Parses a non-negative decimal number into `out`, returns zero on success
+ * and a negative value if `value` is not one
+ */
+int parse_config_double(const char* value, double* out)
+{
+    char* end;
+    double parsed;
+    if (!isdigit((unsigned char)value[0]))
+    {
+        return -1;
+    }
+    parsed = strtod(value, &end);
+    if (*end != '\0')
+    {
+        return -1;
+    }
+    *out = parsed;
+    return 0;
+}
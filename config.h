@@ -0,0 +1,44 @@
+/*
+ * Implements a parser for INI style configuration files
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#define CONFIG_LINE_LEN 256
+
+/*
+ * Called for each `key = value` line, with the name of the enclosing
+ * `[section]`. Returns zero if the entry was accepted, non-zero otherwise
+ */
+typedef int (*config_handler)(
+    const char* section, const char* key, const char* value, void* data);
+
+/*
+ * Reads the file at `path`, passing each entry to `handler`. Text after a '#'
+ * and blank lines are ignored. Returns zero on success, -1 if the file cannot
+ * be opened, and the line number of the first rejected line otherwise
+ */
+int parse_config_file(const char* path, config_handler handler, void* data);
+
+/*
+ * Splits `value` on whitespace into at most `max` tokens, which point into the
+ * modified string. Returns the number of tokens found, or -1 if there are more
+ * than `max`
+ */
+int split_config_value(char* value, char** tokens, int max);
+
+/*
+ * Parses a non-negative decimal integer, or a hexadecimal one with a 0x
+ * prefix, into `out`. Returns zero on success and a negative value if `value`
+ * is not one
+ */
+int parse_config_uint(const char* value, unsigned int* out);
+
+/*
+ * Parses a non-negative decimal number into `out`, returns zero on success
+ * and a negative value if `value` is not one
+ */
+int parse_config_double(const char* value, double* out);
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Implements per button debouncing of arcade bonnet states
+ */
+
+#include <string.h>
+
+#include "debounce.h"
+
+/*
+ * Private helper functions
+ */
+static uint64_t edge_due(const debouncer* deb, int index)
+{
+    int released = (deb->raw >> index) & 1;
+    if (deb->mode == DEBOUNCE_VERIFY && released)
+    {
+        // Releases wait until the raw line has been stable for a window
+        return deb->raw_changed[index] + deb->window;
+    }
+    else if (deb->mode == DEBOUNCE_VERIFY)
+    {
+        return 0;
+    }
+    return deb->accepted[index] + deb->window;
+}
+
+/*
+ * Sets up `deb` starting from `state`, with a window of `window_ms`
+ */
+void init_debouncer(debouncer* deb, debounce_mode mode,
+    unsigned int window_ms, arcade_buttons state)
+{
+    memset(deb, 0, sizeof(debouncer));
+    deb->mode = mode;
+    deb->window = window_ms * 1000000ULL;
+    deb->state = state;
+    deb->raw = state;
+}
+
+/*
+ * Feeds a state read at `now` (CLOCK_MONOTONIC ns) and returns the debounced
+ * state. Call it again with the same raw state once `debounce_deadline` passes
+ */
+arcade_buttons debounce_buttons(debouncer* deb, arcade_buttons raw,
+    uint64_t now)
+{
+    unsigned int edges = raw ^ deb->raw, pending;
+    if (deb->mode == DEBOUNCE_OFF)
+    {
+        deb->state = raw;
+        deb->raw = raw;
+        return raw;
+    }
+
+    // Raw edges against a differing debounced state are bounces
+    deb->raw = raw;
+    while (edges)
+    {
+        int index = __builtin_ctz(edges);
+        edges &= edges - 1;
+        deb->raw_changed[index] = now;
+        if (((raw ^ deb->state) >> index & 1) == 0) deb->bounces[index]++;
+    }
+
+    pending = (raw ^ deb->state) & 0xFFFF;
+    while (pending)
+    {
+        int index = __builtin_ctz(pending);
+        pending &= pending - 1;
+        if (edge_due(deb, index) <= now)
+        {
+            deb->state ^= 1 << index;
+            deb->accepted[index] = now;
+        }
+    }
+    return deb->state;
+}
+
+/*
+ * Returns the time a held back edge becomes due, or 0 if none is pending
+ */
+uint64_t debounce_deadline(const debouncer* deb)
+{
+    unsigned int pending = (deb->raw ^ deb->state) & 0xFFFF;
+    uint64_t deadline = 0;
+    while (pending)
+    {
+        int index = __builtin_ctz(pending);
+        uint64_t due = edge_due(deb, index);
+        pending &= pending - 1;
+        if (!deadline || due < deadline) deadline = due;
+    }
+    return deadline;
+}
@@ -0,0 +1,48 @@
+/*
+ * Implements per button debouncing of arcade bonnet states
+ */
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <stdint.h>
+
+#include "arcade_buttons.h"
+
+#define DEBOUNCE_BUTTONS 16
+
+typedef enum {
+    DEBOUNCE_OFF,
+    DEBOUNCE_EAGER,     // Emit the first edge, ignore edges for a window after
+    DEBOUNCE_VERIFY,    // Emit presses at once, releases once stable for a window
+} debounce_mode;
+
+typedef struct {
+    debounce_mode mode;
+    uint64_t window;                        // ns
+    arcade_buttons state;                   // Debounced state
+    arcade_buttons raw;                     // Last state read from the bonnet
+    uint64_t accepted[DEBOUNCE_BUTTONS];    // Time of the last emitted edge
+    uint64_t raw_changed[DEBOUNCE_BUTTONS]; // Time of the last raw edge
+    unsigned long bounces[DEBOUNCE_BUTTONS];
+} debouncer;
+
+/*
+ * Sets up `deb` starting from `state`, with a window of `window_ms`
+ */
+void init_debouncer(debouncer* deb, debounce_mode mode,
+    unsigned int window_ms, arcade_buttons state);
+
+/*
+ * Feeds a state read at `now` (CLOCK_MONOTONIC ns) and returns the debounced
+ * state. Call it again with the same raw state once `debounce_deadline` passes
+ */
+arcade_buttons debounce_buttons(debouncer* deb, arcade_buttons raw,
+    uint64_t now);
+
+/*
+ * Returns the time a held back edge becomes due, or 0 if none is pending
+ */
+uint64_t debounce_deadline(const debouncer* deb);
+
+#endif
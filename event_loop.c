@@ -0,0 +1,346 @@
+/*
+ * Implements a single threaded epoll event loop over file descriptors, one-shot
+ * timers and signals
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "event_loop.h"
+
+/*
+ * Private helper functions
+ */
+static event_source* new_source(event_loop* loop, int fd,
+    event_source_type type, event_callback callback, void* data)
+{
+    for (int i = 0; i < EVENT_LOOP_MAX_SOURCES; i++)
+    {
+        if (loop->sources[i].fd < 0)
+        {
+            loop->sources[i].fd = fd;
+            loop->sources[i].generation++;
+            loop->sources[i].type = type;
+            loop->sources[i].callback = callback;
+            loop->sources[i].data = data;
+            loop->sources[i].deadline = 0;
+            return &loop->sources[i];
+        }
+    }
+    // Callers only see a failed add, which would look like a bad fd
+    fprintf(stderr, "Error: event loop is full, it holds %d sources\n",
+        EVENT_LOOP_MAX_SOURCES);
+    errno = ENOSPC;
+    return NULL;
+}
+static int watch_source(event_loop* loop, event_source* source, uint32_t events)
+{
+    struct epoll_event ev;
+    ev.events = events;
+    // Tagged with the slot's generation, so events already fetched for a
+    // removed source are not delivered to one added in its place
+    ev.data.u64 = ((uint64_t)source->generation << 32)
+        | (uint64_t)(source - loop->sources);
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, source->fd, &ev) != 0)
+    {
+        source->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Returns the CLOCK_MONOTONIC time in nanoseconds
+ */
+uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Allocates an empty event loop, returns NULL on error
+ */
+event_loop* create_event_loop(void)
+{
+    event_loop* loop = malloc(sizeof(event_loop));
+    if (!loop)
+    {
+        return NULL;
+    }
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0)
+    {
+        free(loop);
+        return NULL;
+    }
+    for (int i = 0; i < EVENT_LOOP_MAX_SOURCES; i++)
+    {
+        loop->sources[i].fd = -1;
+        loop->sources[i].generation = 0;
+    }
+    loop->running = 0;
+    loop->wakeups = 0;
+    loop->spin_until = 0;
+    loop->spin = NULL;
+    loop->spin_data = NULL;
+    loop->spins = 0;
+    loop->spin_ns = 0;
+    loop->spin_pass = 0;
+    reset_histogram(&loop->wakeup_latency);
+    clock_gettime(CLOCK_MONOTONIC, &loop->epoch);
+    return loop;
+}
+
+/*
+ * Calls `callback` whenever `fd` reports any of `events` (EPOLLIN, ...).
+ * Returns zero on success, and a negative value on errors
+ */
+int add_event_fd(event_loop* loop, int fd, uint32_t events,
+    event_callback callback, void* data)
+{
+    event_source* source = new_source(
+        loop, fd, EVENT_SOURCE_FD, callback, data);
+    if (!source)
+    {
+        return -1;
+    }
+    return watch_source(loop, source, events);
+}
+
+/*
+ * Stops watching `fd`, it is not closed
+ */
+void remove_event_fd(event_loop* loop, int fd)
+{
+    for (int i = 0; i < EVENT_LOOP_MAX_SOURCES; i++)
+    {
+        if (loop->sources[i].fd == fd)
+        {
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            loop->sources[i].fd = -1;
+        }
+    }
+}
+
+/*
+ * Creates a disarmed one-shot timer calling `callback` when it expires.
+ * Returns the timer's file descriptor, and a negative value on errors
+ */
+int add_event_timer(event_loop* loop, event_callback callback, void* data)
+{
+    event_source* source;
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    source = new_source(loop, fd, EVENT_SOURCE_TIMER, callback, data);
+    if (!source || watch_source(loop, source, EPOLLIN) != 0)
+    {
+        close(fd);
+        return -2;
+    }
+    return fd;
+}
+
+/*
+ * Arms the timer `fd` of `loop` to expire at the absolute CLOCK_MONOTONIC time
+ * `deadline` in ns, or disarms it if `deadline` is 0. Returns zero on success,
+ * and a negative value on errors
+ */
+int arm_event_timer(event_loop* loop, int fd, uint64_t deadline)
+{
+    struct itimerspec spec = { 0 };
+    // Kept to tell how late the loop woke up for it
+    for (int i = 0; i < EVENT_LOOP_MAX_SOURCES; i++)
+    {
+        if (loop->sources[i].fd == fd)
+        {
+            loop->sources[i].deadline = deadline;
+            break;
+        }
+    }
+    spec.it_value.tv_sec = deadline / 1000000000ULL;
+    spec.it_value.tv_nsec = deadline % 1000000000ULL;
+    return timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/*
+ * Blocks the `count` signals in `signals` and delivers them to `callback`
+ * through a signalfd instead. Must be called before any threads are started.
+ * Returns zero on success, and a negative value on errors
+ */
+int add_event_signals(event_loop* loop, const int* signals, int count,
+    event_callback callback, void* data)
+{
+    sigset_t mask;
+    event_source* source;
+    int fd;
+
+    sigemptyset(&mask);
+    for (int i = 0; i < count; i++)
+    {
+        sigaddset(&mask, signals[i]);
+    }
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0)
+    {
+        return -1;
+    }
+    fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return -2;
+    }
+
+    source = new_source(loop, fd, EVENT_SOURCE_SIGNAL, callback, data);
+    if (!source || watch_source(loop, source, EPOLLIN) != 0)
+    {
+        close(fd);
+        return -3;
+    }
+    return 0;
+}
+
+/*
+ * Dispatches events until `stop_event_loop` is called, returns zero when
+ * stopped, and a negative value on errors
+ */
+int run_event_loop(event_loop* loop)
+{
+    struct epoll_event events[EVENT_LOOP_MAX_SOURCES];
+    loop->running = 1;
+    while (loop->running)
+    {
+        int count, timeout = -1;
+        uint64_t woke;
+        if (loop->spin_until)
+        {
+            uint64_t now = monotonic_ns();
+            uint64_t end = now < loop->spin_until ? now : loop->spin_until;
+            // Count the time since the previous pass, up to the window's end
+            if (loop->spin_pass && end > loop->spin_pass)
+            {
+                __atomic_store_n(&loop->spin_ns,
+                    loop->spin_ns + (end - loop->spin_pass), __ATOMIC_RELAXED);
+            }
+            if (now < loop->spin_until)
+            {
+                // Sources are still checked on every pass, just never waited on
+                timeout = 0;
+                loop->spins++;
+                loop->spin_pass = now;
+                loop->spin(loop, now, loop->spin_data);
+            }
+            else
+            {
+                // Other threads read it, a plain 64 bit store can tear
+                __atomic_store_n(&loop->spin_until, 0, __ATOMIC_RELAXED);
+                loop->spin_pass = 0;
+            }
+        }
+        count = epoll_wait(
+            loop->epoll_fd, events, EVENT_LOOP_MAX_SOURCES, timeout);
+        if (count < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        else if (count == 0)
+        {
+            continue;
+        }
+        loop->wakeups++;
+        woke = monotonic_ns();
+
+        for (int i = 0; i < count; i++)
+        {
+            event_source* source =
+                &loop->sources[events[i].data.u64 & 0xFFFFFFFF];
+            struct signalfd_siginfo info;
+            uint64_t expirations;
+
+            // Source may have been removed, and its slot even reused, by an
+            // earlier callback
+            if (source->fd < 0
+                || source->generation != events[i].data.u64 >> 32)
+            {
+                continue;
+            }
+            switch (source->type)
+            {
+                case EVENT_SOURCE_FD:
+                    source->callback(loop, events[i].events, source->data);
+                    break;
+                case EVENT_SOURCE_TIMER:
+                    // Skip expiries of a timer re-armed by an earlier callback
+                    if (read(source->fd, &expirations, sizeof(expirations))
+                        == sizeof(expirations))
+                    {
+                        if (source->deadline && woke > source->deadline)
+                        {
+                            histogram_add(&loop->wakeup_latency,
+                                woke - source->deadline);
+                        }
+                        source->deadline = 0;
+                        source->callback(loop, monotonic_ns(), source->data);
+                    }
+                    break;
+                case EVENT_SOURCE_SIGNAL:
+                    while (read(source->fd, &info, sizeof(info))
+                        == sizeof(info))
+                    {
+                        source->callback(loop, info.ssi_signo, source->data);
+                    }
+                    break;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Keeps the loop polling its sources without sleeping until the
+ * CLOCK_MONOTONIC time `until` in ns, calling `callback` with the time of
+ * each pass. A later call replaces the window
+ */
+void spin_event_loop(event_loop* loop, uint64_t until, event_callback callback,
+    void* data)
+{
+    __atomic_store_n(&loop->spin_until, until, __ATOMIC_RELAXED);
+    loop->spin = callback;
+    loop->spin_data = data;
+}
+
+/*
+ * Makes `run_event_loop` return after the current dispatch
+ */
+void stop_event_loop(event_loop* loop)
+{
+    loop->running = 0;
+}
+
+/*
+ * Closes the timers, signalfd and epoll instance and frees memory. Watched
+ * file descriptors added with `add_event_fd` are left open
+ */
+void close_event_loop(event_loop* loop)
+{
+    for (int i = 0; i < EVENT_LOOP_MAX_SOURCES; i++)
+    {
+        if (loop->sources[i].fd >= 0
+            && loop->sources[i].type != EVENT_SOURCE_FD)
+        {
+            close(loop->sources[i].fd);
+        }
+    }
+    close(loop->epoll_fd);
+    free(loop);
+}
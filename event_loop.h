@@ -0,0 +1,127 @@
+/*
+ * Implements a single threaded epoll event loop over file descriptors, one-shot
+ * timers and signals
+ */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
+#include "histogram.h"
+
+#define EVENT_LOOP_MAX_SOURCES 32
+
+typedef struct event_loop event_loop;
+
+/*
+ * Called when a source is ready. `value` holds the epoll event mask for file
+ * descriptors, the CLOCK_MONOTONIC ns time of dispatch for timers, and the
+ * signal number for signals
+ */
+typedef void (*event_callback)(event_loop* loop, uint64_t value, void* data);
+
+typedef enum {
+    EVENT_SOURCE_FD,
+    EVENT_SOURCE_TIMER,
+    EVENT_SOURCE_SIGNAL,
+} event_source_type;
+
+typedef struct {
+    int fd;
+    uint32_t generation;        // Bumped each time the slot is reused
+    event_source_type type;
+    event_callback callback;
+    void* data;
+    uint64_t deadline;          // Expiry of an armed timer, 0 if disarmed
+} event_source;
+
+struct event_loop {
+    int epoll_fd;
+    int running;
+    struct timespec epoch;      // CLOCK_MONOTONIC time the loop was created
+    unsigned long wakeups;      // Number of times epoll_wait returned
+    uint64_t spin_until;        // Poll without sleeping until this time,
+                                // stored atomically for other threads
+    event_callback spin;        // Called on each pass while spinning
+    void* spin_data;
+    unsigned long spins;        // Passes made while spinning
+    uint64_t spin_ns;           // Total time spent spinning, stored
+                                // atomically for other threads
+    uint64_t spin_pass;         // Time of the last pass, 0 when not spinning
+    histogram wakeup_latency;   // Return from epoll_wait minus timer expiry
+    event_source sources[EVENT_LOOP_MAX_SOURCES];
+};
+
+/*
+ * Returns the CLOCK_MONOTONIC time in nanoseconds
+ */
+uint64_t monotonic_ns(void);
+
+/*
+ * Allocates an empty event loop, returns NULL on error
+ */
+event_loop* create_event_loop(void);
+
+/*
+ * Calls `callback` whenever `fd` reports any of `events` (EPOLLIN, ...).
+ * Returns zero on success, and a negative value on errors
+ */
+int add_event_fd(event_loop* loop, int fd, uint32_t events,
+    event_callback callback, void* data);
+
+/*
+ * Stops watching `fd`, it is not closed
+ */
+void remove_event_fd(event_loop* loop, int fd);
+
+/*
+ * Creates a disarmed one-shot timer calling `callback` when it expires.
+ * Returns the timer's file descriptor, and a negative value on errors
+ */
+int add_event_timer(event_loop* loop, event_callback callback, void* data);
+
+/*
+ * Arms the timer `fd` of `loop` to expire at the absolute CLOCK_MONOTONIC time
+ * `deadline` in ns, or disarms it if `deadline` is 0. Returns zero on success,
+ * and a negative value on errors
+ */
+int arm_event_timer(event_loop* loop, int fd, uint64_t deadline);
+
+/*
+ * Blocks the `count` signals in `signals` and delivers them to `callback`
+ * through a signalfd instead. Must be called before any threads are started.
+ * Returns zero on success, and a negative value on errors
+ */
+int add_event_signals(event_loop* loop, const int* signals, int count,
+    event_callback callback, void* data);
+
+/*
+ * Dispatches events until `stop_event_loop` is called, returns zero when
+ * stopped, and a negative value on errors
+ */
+int run_event_loop(event_loop* loop);
+
+/*
+ * Keeps the loop polling its sources without sleeping until the
+ * CLOCK_MONOTONIC time `until` in ns, calling `callback` with the time of
+ * each pass. A later call replaces the window
+ */
+void spin_event_loop(event_loop* loop, uint64_t until, event_callback callback,
+    void* data);
+
+/*
+ * Makes `run_event_loop` return after the current dispatch
+ */
+void stop_event_loop(event_loop* loop);
+
+/*
+ * Closes the timers, signalfd and epoll instance and frees memory. Watched
+ * file descriptors added with `add_event_fd` are left open
+ */
+void close_event_loop(event_loop* loop);
+
+#endif
@@ -0,0 +1,356 @@
+/*
+ * Implements long press, double tap and hold repeat gestures per button
+ */
+
+#include <string.h>
+
+#include "gesture.h"
+#include "config.h"
+
+/*
+ * Private helper functions
+ */
+static void add_action(gesture_result* result, const gesture_action* action,
+    int32_t value)
+{
+    if (action->key)
+    {
+        result->events[result->event_count].type = EV_KEY;
+        result->events[result->event_count].code = action->key;
+        result->events[result->event_count].value = value;
+        result->event_count++;
+    }
+    // Commands run when the gesture starts, and on each repeat
+    if (action->command >= 0 && value)
+    {
+        result->commands[result->command_count++] = action->command;
+    }
+}
+
+static gesture_action* find_action(gesture_engine* engine, const char* key)
+{
+    char button[CONFIG_LINE_LEN], *kind;
+    int index;
+    strncpy(button, key, sizeof(button) - 1);
+    button[sizeof(button) - 1] = '\0';
+    kind = strchr(button, '.');
+    if (!kind)
+    {
+        return NULL;
+    }
+    *kind++ = '\0';
+    index = keymap_button_index(button);
+    if (index < 0)
+    {
+        return NULL;
+    }
+    if (strcmp(kind, "long") == 0)
+    {
+        return &engine->long_press[index];
+    }
+    else if (strcmp(kind, "double") == 0)
+    {
+        return &engine->double_tap[index];
+    }
+    else if (strcmp(kind, "repeat") == 0)
+    {
+        return &engine->repeat[index];
+    }
+    return NULL;
+}
+
+static int is_set(const gesture_action* action)
+{
+    return action->key || action->command >= 0;
+}
+
+static void update_masks(gesture_engine* engine)
+{
+    // Long presses and double taps hold the button back, and take precedence
+    // over repeating it
+    engine->gestures = 0;
+    engine->repeats = 0;
+    for (int i = 0; i < KEYMAP_BUTTONS; i++)
+    {
+        if (is_set(&engine->long_press[i]) || is_set(&engine->double_tap[i]))
+        {
+            engine->gestures |= 1 << i;
+        }
+        else if (is_set(&engine->repeat[i]))
+        {
+            engine->repeats |= 1 << i;
+        }
+    }
+}
+
+static void set_deadline(gesture_engine* engine, int index, uint64_t deadline)
+{
+    engine->deadline[index] = deadline;
+    if (deadline)
+    {
+        engine->timed |= 1 << index;
+    }
+    else
+    {
+        engine->timed &= ~(1 << index);
+    }
+}
+
+static void finish(gesture_engine* engine, uint16_t taps,
+    gesture_result* result)
+{
+    // Held back buttons look released to the keymap, until sent as a tap
+    arcade_buttons state = engine->input | engine->gestures;
+    result->state_count = 0;
+    if (taps)
+    {
+        result->states[result->state_count++] = state & ~taps;
+    }
+    result->states[result->state_count++] = state;
+}
+
+static int parse_timing(const char* value, uint64_t* out)
+{
+    unsigned int ms;
+    if (parse_config_uint(value, &ms) != 0 || ms == 0)
+    {
+        return -1;
+    }
+    *out = ms * 1000000ULL;
+    return 0;
+}
+
+/*
+ * Sets up `engine` without gestures, using the default timings
+ */
+void init_gestures(gesture_engine* engine)
+{
+    memset(engine, 0, sizeof(gesture_engine));
+    engine->long_time = GESTURE_LONG_PRESS * 1000000ULL;
+    engine->double_time = GESTURE_DOUBLE_TAP * 1000000ULL;
+    engine->repeat_delay = GESTURE_REPEAT_DELAY * 1000000ULL;
+    engine->repeat_period = GESTURE_REPEAT_PERIOD * 1000000ULL;
+    engine->input = 0xFFFF;
+    for (int i = 0; i < KEYMAP_BUTTONS; i++)
+    {
+        engine->long_press[i].command = -1;
+        engine->double_tap[i].command = -1;
+        engine->repeat[i].command = -1;
+    }
+}
+
+/*
+ * Handles a [gestures] configuration entry, either a timing (long_ms,
+ * double_ms, repeat_delay_ms, repeat_ms) or a gesture of a button
+ * (BUTTON_1A.long, BUTTON_1A.double, BUTTON_1A.repeat) with the key it sends.
+ * Returns zero on success, and a negative value on an invalid entry
+ */
+int configure_gesture(gesture_engine* engine, const char* key,
+    const char* value)
+{
+    gesture_action* action;
+    keymap_entry entry;
+
+    if (strcmp(key, "long_ms") == 0)
+    {
+        return parse_timing(value, &engine->long_time);
+    }
+    else if (strcmp(key, "double_ms") == 0)
+    {
+        return parse_timing(value, &engine->double_time);
+    }
+    else if (strcmp(key, "repeat_delay_ms") == 0)
+    {
+        return parse_timing(value, &engine->repeat_delay);
+    }
+    else if (strcmp(key, "repeat_ms") == 0)
+    {
+        return parse_timing(value, &engine->repeat_period);
+    }
+
+    action = find_action(engine, key);
+    if (!action)
+    {
+        return -1;
+    }
+    if (parse_keymap_entry(value, &entry) != 0
+        || entry.count != 1 || entry.outputs[0].type != EV_KEY)
+    {
+        return -2;
+    }
+    action->key = entry.outputs[0].code;
+    update_masks(engine);
+    return 0;
+}
+
+/*
+ * Binds command `command` to the gesture `key` names (BUTTON_1A.long, ...),
+ * returns zero on success, and a negative value on an invalid gesture
+ */
+int add_gesture_command(gesture_engine* engine, const char* key,
+    int command)
+{
+    gesture_action* action = find_action(engine, key);
+    if (!action)
+    {
+        return -1;
+    }
+    action->command = command;
+    update_masks(engine);
+    return 0;
+}
+
+/*
+ * Lets `device` send every key used by the gestures, returns zero on success,
+ * and a negative value on errors
+ */
+int enable_gesture_outputs(const gesture_engine* engine,
+    input_device* device)
+{
+    for (int i = 0; i < KEYMAP_BUTTONS; i++)
+    {
+        if ((engine->long_press[i].key
+                && enable_device_key(device, engine->long_press[i].key) != 0)
+            || (engine->double_tap[i].key
+                && enable_device_key(device, engine->double_tap[i].key) != 0)
+            || (engine->repeat[i].key
+                && enable_device_key(device, engine->repeat[i].key) != 0))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Feeds `state` at `now` (CLOCK_MONOTONIC ns), filling `result`. Buttons
+ * without gestures pass through unchanged and undelayed
+ */
+void gesture_update(gesture_engine* engine, arcade_buttons state,
+    uint64_t now, gesture_result* result)
+{
+    // Inputs are pulled up, a cleared bit is a pressed button
+    uint16_t held = ~state & (engine->gestures | engine->repeats);
+    uint16_t changed = held ^ engine->held, taps = 0;
+    engine->input = state;
+    engine->held = held;
+    result->event_count = 0;
+    result->command_count = 0;
+
+    for (; changed; changed &= changed - 1)
+    {
+        int index = __builtin_ctz(changed);
+        int pressed = (held >> index) & 1;
+        gesture_phase phase = engine->phase[index];
+
+        if (pressed && phase == GESTURE_RELEASED)
+        {
+            engine->double_taps++;
+            add_action(result, &engine->double_tap[index], 1);
+            engine->phase[index] = GESTURE_DOUBLE;
+            set_deadline(engine, index, 0);
+        }
+        else if (pressed && (engine->gestures & (1 << index)))
+        {
+            engine->phase[index] = GESTURE_PRESSED;
+            set_deadline(engine, index,
+                is_set(&engine->long_press[index])
+                    ? now + engine->long_time : 0);
+        }
+        else if (pressed)
+        {
+            engine->phase[index] = GESTURE_HELD;
+            set_deadline(engine, index, now + engine->repeat_delay);
+        }
+        else if (phase == GESTURE_PRESSED
+            && is_set(&engine->double_tap[index]))
+        {
+            engine->phase[index] = GESTURE_RELEASED;
+            set_deadline(engine, index, now + engine->double_time);
+        }
+        else
+        {
+            // A short press without a double tap gesture is a plain tap
+            if (phase == GESTURE_PRESSED) taps |= 1 << index;
+            if (phase == GESTURE_LONG)
+            {
+                add_action(result, &engine->long_press[index], 0);
+            }
+            if (phase == GESTURE_DOUBLE)
+            {
+                add_action(result, &engine->double_tap[index], 0);
+            }
+            if (phase == GESTURE_REPEAT)
+            {
+                add_action(result, &engine->repeat[index], 0);
+            }
+            engine->phase[index] = GESTURE_IDLE;
+            set_deadline(engine, index, 0);
+        }
+    }
+    finish(engine, taps, result);
+}
+
+/*
+ * Advances the gestures whose deadline passed by `now`, filling `result`
+ */
+void gesture_expire(gesture_engine* engine, uint64_t now,
+    gesture_result* result)
+{
+    uint16_t taps = 0;
+    result->event_count = 0;
+    result->command_count = 0;
+    for (uint16_t timed = engine->timed; timed; timed &= timed - 1)
+    {
+        int index = __builtin_ctz(timed);
+        uint64_t deadline = engine->deadline[index];
+        if (deadline > now)
+        {
+            continue;
+        }
+
+        switch (engine->phase[index])
+        {
+            case GESTURE_PRESSED:
+                engine->long_presses++;
+                add_action(result, &engine->long_press[index], 1);
+                engine->phase[index] = GESTURE_LONG;
+                set_deadline(engine, index, 0);
+                break;
+            case GESTURE_RELEASED:
+                // No second tap came, send the first one as it was
+                taps |= 1 << index;
+                engine->phase[index] = GESTURE_IDLE;
+                set_deadline(engine, index, 0);
+                break;
+            case GESTURE_HELD:
+            case GESTURE_REPEAT:
+                // Repeats after the first are sent as autorepeat (value 2)
+                engine->repeats_sent++;
+                add_action(result, &engine->repeat[index],
+                    engine->phase[index] == GESTURE_HELD ? 1 : 2);
+                engine->phase[index] = GESTURE_REPEAT;
+                while (deadline <= now) deadline += engine->repeat_period;
+                set_deadline(engine, index, deadline);
+                break;
+            default:
+                set_deadline(engine, index, 0);
+                break;
+        }
+    }
+    finish(engine, taps, result);
+}
+
+/*
+ * Returns the earliest gesture deadline, or 0 if none is pending
+ */
+uint64_t gesture_deadline(const gesture_engine* engine)
+{
+    uint64_t deadline = 0;
+    for (uint16_t timed = engine->timed; timed; timed &= timed - 1)
+    {
+        uint64_t next = engine->deadline[__builtin_ctz(timed)];
+        if (!deadline || next < deadline) deadline = next;
+    }
+    return deadline;
+}
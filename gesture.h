@@ -0,0 +1,117 @@
+/*
+ * Implements long press, double tap and hold repeat gestures per button
+ */
+
+#ifndef GESTURE_H
+#define GESTURE_H
+
+#include <stdint.h>
+
+#include "arcade_buttons.h"
+#include "input_device.h"
+#include "keymap.h"
+
+#define GESTURE_LONG_PRESS      500     // ms
+#define GESTURE_DOUBLE_TAP      250     // ms
+#define GESTURE_REPEAT_DELAY    400     // ms
+#define GESTURE_REPEAT_PERIOD   100     // ms
+
+typedef enum {
+    GESTURE_IDLE,
+    GESTURE_PRESSED,        // Held back, waiting for a long press
+    GESTURE_LONG,           // Long press key held
+    GESTURE_RELEASED,       // Tapped once, waiting for a second tap
+    GESTURE_DOUBLE,         // Double tap key held
+    GESTURE_HELD,           // Passed on, waiting to start repeating
+    GESTURE_REPEAT,         // Repeating
+} gesture_phase;
+
+/*
+ * What a gesture sends, a key, a command, or both
+ */
+typedef struct {
+    uint16_t key;                       // 0 for none
+    int16_t command;                    // Command index, -1 for none
+} gesture_action;
+
+typedef struct {
+    uint64_t long_time;                 // ns
+    uint64_t double_time;               // ns
+    uint64_t repeat_delay;              // ns
+    uint64_t repeat_period;             // ns
+    gesture_action long_press[KEYMAP_BUTTONS];
+    gesture_action double_tap[KEYMAP_BUTTONS];
+    gesture_action repeat[KEYMAP_BUTTONS];
+    uint16_t gestures;                  // Buttons held back for a gesture
+    uint16_t repeats;                   // Buttons repeating while held
+
+    arcade_buttons input;               // Last state fed in
+    uint16_t held;
+    uint16_t timed;                     // Buttons waiting on `deadline`
+    gesture_phase phase[KEYMAP_BUTTONS];
+    uint64_t deadline[KEYMAP_BUTTONS];
+    unsigned long long_presses;
+    unsigned long double_taps;
+    unsigned long repeats_sent;
+} gesture_engine;
+
+/*
+ * What one update produced, the button states to pass on in order, the
+ * gesture key events to send and the commands to run
+ */
+typedef struct {
+    int state_count;
+    arcade_buttons states[2];
+    int event_count;
+    device_event events[KEYMAP_BUTTONS];
+    int command_count;
+    int commands[KEYMAP_BUTTONS];
+} gesture_result;
+
+/*
+ * Sets up `engine` without gestures, using the default timings
+ */
+void init_gestures(gesture_engine* engine);
+
+/*
+ * Handles a [gestures] configuration entry, either a timing (long_ms,
+ * double_ms, repeat_delay_ms, repeat_ms) or a gesture of a button
+ * (BUTTON_1A.long, BUTTON_1A.double, BUTTON_1A.repeat) with the key it sends.
+ * Returns zero on success, and a negative value on an invalid entry
+ */
+int configure_gesture(gesture_engine* engine, const char* key,
+    const char* value);
+
+/*
+ * Binds command `command` to the gesture `key` names (BUTTON_1A.long, ...),
+ * returns zero on success, and a negative value on an invalid gesture
+ */
+int add_gesture_command(gesture_engine* engine, const char* key,
+    int command);
+
+/*
+ * Lets `device` send every key used by the gestures, returns zero on success,
+ * and a negative value on errors
+ */
+int enable_gesture_outputs(const gesture_engine* engine,
+    input_device* device);
+
+/*
+ * Feeds `state` at `now` (CLOCK_MONOTONIC ns), filling `result`. Buttons
+ * without gestures pass through unchanged and undelayed
+ */
+void gesture_update(gesture_engine* engine, arcade_buttons state,
+    uint64_t now, gesture_result* result);
+
+/*
+ * Advances the gestures whose deadline passed by `now`, filling `result`
+ */
+void gesture_expire(gesture_engine* engine, uint64_t now,
+    gesture_result* result);
+
+/*
+ * Returns the earliest gesture deadline, or 0 if none is pending
+ */
+uint64_t gesture_deadline(const gesture_engine* engine);
+
+#endif
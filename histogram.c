@@ -0,0 +1,69 @@
+/*
+ * Implements fixed size log2 histograms of nanosecond durations
+ */
+
+#include <string.h>
+
+#include "histogram.h"
+
+/*
+ * Empties a histogram
+ */
+void reset_histogram(histogram* hist)
+{
+    memset(hist, 0, sizeof(histogram));
+    hist->min = UINT64_MAX;
+}
+
+/*
+ * Records one value in nanoseconds
+ */
+void histogram_add(histogram* hist, uint64_t value)
+{
+    int bucket = value ? 64 - __builtin_clzll(value) : 0;
+    if (bucket >= HISTOGRAM_BUCKETS) bucket = HISTOGRAM_BUCKETS - 1;
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->sum += value;
+    if (value < hist->min) hist->min = value;
+    if (value > hist->max) hist->max = value;
+}
+
+/*
+ * Returns an upper bound in nanoseconds for the `p`th percentile (0.0 - 1.0)
+ */
+uint64_t histogram_percentile(const histogram* hist, double p)
+{
+    uint64_t seen = 0, target = (uint64_t)(p * hist->count);
+    if (hist->count == 0)
+    {
+        return 0;
+    }
+    for (int i = 0; i < HISTOGRAM_BUCKETS - 1; i++)
+    {
+        seen += hist->buckets[i];
+        if (seen > target)
+        {
+            uint64_t bound = (1ULL << i) - 1;
+            return bound < hist->max ? bound : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+/*
+ * Writes a one line summary in microseconds, prefixed by `name`
+ */
+void print_histogram(FILE* out, const char* name, const histogram* hist)
+{
+    if (hist->count == 0)
+    {
+        fprintf(out, "%s: no samples\n", name);
+        return;
+    }
+    fprintf(out, "%s: n=%llu min=%.1fus avg=%.1fus p50<=%.1fus p99<=%.1fus "
+        "max=%.1fus\n", name, (unsigned long long)hist->count,
+        hist->min / 1e3, (double)hist->sum / hist->count / 1e3,
+        histogram_percentile(hist, 0.5) / 1e3,
+        histogram_percentile(hist, 0.99) / 1e3, hist->max / 1e3);
+}
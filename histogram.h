@@ -0,0 +1,42 @@
+/*
+ * Implements fixed size log2 histograms of nanosecond durations
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Bucket i counts values in [2^(i-1), 2^i) ns, the last one everything above
+#define HISTOGRAM_BUCKETS 32
+
+typedef struct {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+} histogram;
+
+/*
+ * Empties a histogram
+ */
+void reset_histogram(histogram* hist);
+
+/*
+ * Records one value in nanoseconds
+ */
+void histogram_add(histogram* hist, uint64_t value);
+
+/*
+ * Returns an upper bound in nanoseconds for the `p`th percentile (0.0 - 1.0)
+ */
+uint64_t histogram_percentile(const histogram* hist, double p);
+
+/*
+ * Writes a one line summary in microseconds, prefixed by `name`
+ */
+void print_histogram(FILE* out, const char* name, const histogram* hist);
+
+#endif
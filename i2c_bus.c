@@ -0,0 +1,502 @@
+/*
+ * Implements I2C transfers shared by the device drivers, which can be traced
+ * to a file and replayed from one instead of the bus
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+
+// Needed for i2c bus
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+
+#include "i2c_bus.h"
+#include "event_loop.h"
+
+// Traced records collect in memory and a writer thread saves them, so
+// neither the input loop nor the battery thread ever waits on the disk
+#define TRACE_BATCH         2048    // Records in each of the two buffers
+#define TRACE_FLUSH_MS      1000    // Longest a record waits to be written
+// Stands in for a bus while replaying, never a real file descriptor
+#define REPLAY_HANDLE       0x7fffffff
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+} trace_header;
+
+// One request a replay has seen, and where it is in the trace
+typedef struct {
+    uint16_t addr;
+    uint8_t write_len;
+    uint8_t read_len;
+    uint8_t out[I2C_MAX_TRANSFER];
+    size_t next;                        // Index of the next record to look at
+    const i2c_trace_record* last;       // Response served last
+} replay_key;
+
+typedef enum {
+    MODE_DIRECT,
+    MODE_TRACE,
+    MODE_REPLAY,
+} transport_mode;
+
+// Transfers come from the input loop and the battery thread, tracing and
+// replaying share their state under `lock`. It is never held across a bus
+// transfer or a file write, and direct transfers take no lock at all
+static transport_mode mode = MODE_DIRECT;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* trace_file = NULL;
+static i2c_trace_record* batch_memory = NULL;
+static i2c_trace_record* batches[2];   // Filled, and being written
+static size_t batch_fill = 0;
+static pthread_t trace_writer;
+static pthread_cond_t trace_wake;
+static int trace_stopping = 0, write_failed = 0;
+static unsigned long lost = 0;          // Records that could not be written
+static const i2c_trace_record* records = NULL;
+static size_t record_count = 0, mapped_size = 0;
+static i2c_replay_speed replay_speed;
+static uint64_t replay_start, trace_start, trace_clock;
+static int replay_done = 0;
+static replay_key keys[I2C_REPLAY_KEYS];
+static int key_count = 0;
+static unsigned long transfers = 0, misses = 0;
+
+/*
+ * Private helper functions
+ */
+static int bus_transfer(int bus, uint16_t addr, const uint8_t* out,
+    int write_len, uint8_t* in, int read_len)
+{
+    struct i2c_msg msgs[2];
+    struct i2c_rdwr_ioctl_data xfer = { .msgs = msgs, .nmsgs = 0 };
+    if (write_len)
+    {
+        msgs[xfer.nmsgs++] = (struct i2c_msg){ .addr = addr, .flags = 0,
+            .len = write_len, .buf = (uint8_t*)out };
+    }
+    if (read_len)
+    {
+        msgs[xfer.nmsgs++] = (struct i2c_msg){ .addr = addr,
+            .flags = I2C_M_RD, .len = read_len, .buf = in };
+    }
+    return ioctl(bus, I2C_RDWR, &xfer) == (int)xfer.nmsgs ? 0 : -1;
+}
+
+static void* trace_writer_main(void* data)
+{
+    i2c_trace_record* batch;
+    struct timespec deadline;
+    size_t count, written;
+    int failed;
+    pthread_mutex_lock(&lock);
+    while (!trace_stopping || batch_fill)
+    {
+        // Half a buffer, or whatever is there once a second
+        if (!trace_stopping && batch_fill < TRACE_BATCH / 2)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += TRACE_FLUSH_MS / 1000;
+            if (pthread_cond_timedwait(&trace_wake, &lock, &deadline)
+                != ETIMEDOUT)
+            {
+                continue;
+            }
+        }
+        batch = batches[0];
+        count = batch_fill;
+        batches[0] = batches[1];
+        batches[1] = batch;
+        batch_fill = 0;
+        if (write_failed)
+        {
+            lost += count;
+            continue;
+        }
+
+        pthread_mutex_unlock(&lock);
+        written = fwrite(batch, sizeof(i2c_trace_record), count, trace_file);
+        failed = written != count || fflush(trace_file) != 0;
+        pthread_mutex_lock(&lock);
+        if (failed)
+        {
+            // A full disk, everything from here on is lost
+            write_failed = 1;
+            lost += count - written;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static int record_matches(const i2c_trace_record* record,
+    const replay_key* key)
+{
+    return record->addr == key->addr && record->write_len == key->write_len
+        && record->read_len == key->read_len
+        && memcmp(record->data, key->out, key->write_len) == 0;
+}
+
+static replay_key* find_key(uint16_t addr, const uint8_t* out,
+    int write_len, int read_len)
+{
+    replay_key* key;
+    for (int i = 0; i < key_count; i++)
+    {
+        key = &keys[i];
+        if (key->addr == addr && key->write_len == write_len
+            && key->read_len == read_len
+            && memcmp(key->out, out, write_len) == 0)
+        {
+            return key;
+        }
+    }
+    if (key_count == I2C_REPLAY_KEYS)
+    {
+        return NULL;
+    }
+    key = &keys[key_count++];
+    memset(key, 0, sizeof(replay_key));
+    key->addr = addr;
+    key->write_len = write_len;
+    key->read_len = read_len;
+    memcpy(key->out, out, write_len);
+    return key;
+}
+
+// Returns the response to `key`, NULL if the trace has none
+static const i2c_trace_record* serve(replay_key* key)
+{
+    size_t i = key->next;
+    if (replay_speed == I2C_REPLAY_REALTIME)
+    {
+        // The latest response at the time into the trace the replay is at
+        uint64_t at = trace_start + (monotonic_ns() - replay_start);
+        for (; i < record_count && records[i].time <= at; i++)
+        {
+            if (record_matches(&records[i], key)) key->last = &records[i];
+        }
+        key->next = i;
+        if (key->last)
+        {
+            return key->last;
+        }
+    }
+    // Fast replays, and requests not made yet at this point of the trace,
+    // take the next response in order
+    for (; i < record_count && !record_matches(&records[i], key); i++);
+    if (i == record_count)
+    {
+        if (replay_speed == I2C_REPLAY_FAST) replay_done = 1;
+        return key->last;
+    }
+    key->last = &records[i];
+    key->next = i + 1;
+    if (key->last->time > trace_clock) trace_clock = key->last->time;
+    return key->last;
+}
+
+static int replay_transfer(uint16_t addr, const uint8_t* out, int write_len,
+    uint8_t* in, int read_len)
+{
+    const i2c_trace_record* record;
+    replay_key* key;
+    // Writes only changed the device, which is not there
+    if (!read_len)
+    {
+        return 0;
+    }
+    key = find_key(addr, out, write_len, read_len);
+    record = key ? serve(key) : NULL;
+    if (!record) misses++;
+    if (!record || record->result != 0)
+    {
+        return -1;
+    }
+    memcpy(in, record->data + write_len, read_len);
+    return 0;
+}
+
+/*
+ * Logs every later transfer to `path`. Returns zero on success, and a negative
+ * value on errors
+ */
+int trace_i2c(const char* path)
+{
+    trace_header header = { I2C_TRACE_MAGIC, I2C_TRACE_VERSION, 0 };
+    pthread_condattr_t attr;
+    sigset_t all, old;
+    int ret;
+    trace_file = fopen(path, "wb");
+    if (!trace_file)
+    {
+        return -1;
+    }
+    batch_memory = malloc(2 * TRACE_BATCH * sizeof(i2c_trace_record));
+    if (!batch_memory
+        || fwrite(&header, sizeof(header), 1, trace_file) != 1)
+    {
+        free(batch_memory);
+        batch_memory = NULL;
+        fclose(trace_file);
+        trace_file = NULL;
+        return -2;
+    }
+    batches[0] = batch_memory;
+    batches[1] = batch_memory + TRACE_BATCH;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&trace_wake, &attr);
+    pthread_condattr_destroy(&attr);
+    // Signals are for the input loop's signalfd, never the writer
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    ret = pthread_create(&trace_writer, NULL, trace_writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret != 0)
+    {
+        pthread_cond_destroy(&trace_wake);
+        free(batch_memory);
+        batch_memory = NULL;
+        fclose(trace_file);
+        trace_file = NULL;
+        return -3;
+    }
+    mode = MODE_TRACE;
+    return 0;
+}
+
+/*
+ * Serves every later transfer from the trace at `path` instead of the bus.
+ * Returns zero on success, and a negative value if the file cannot be read or
+ * is not a trace
+ */
+int replay_i2c(const char* path, i2c_replay_speed speed)
+{
+    const trace_header* header;
+    struct stat info;
+    void* map;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(trace_header))
+    {
+        close(fd);
+        return -2;
+    }
+    // Mapped whole, requests look ahead in it independently of each other
+    map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return -3;
+    }
+    header = map;
+    if (header->magic != I2C_TRACE_MAGIC
+        || header->version != I2C_TRACE_VERSION)
+    {
+        munmap(map, info.st_size);
+        return -2;
+    }
+
+    mapped_size = info.st_size;
+    records = (const i2c_trace_record*)(header + 1);
+    record_count = (mapped_size - sizeof(trace_header))
+        / sizeof(i2c_trace_record);
+    replay_speed = speed;
+    replay_start = monotonic_ns();
+    trace_start = record_count ? records[0].time : 0;
+    trace_clock = trace_start;
+    mode = MODE_REPLAY;
+    return 0;
+}
+
+/*
+ * Returns 1 once a fast replay ran out of responses, 0 otherwise
+ */
+int i2c_replay_done(void)
+{
+    int done;
+    pthread_mutex_lock(&lock);
+    done = replay_done;
+    pthread_mutex_unlock(&lock);
+    return done;
+}
+
+/*
+ * Returns the CLOCK_MONOTONIC time in ns, or the time of the response served
+ * last during a fast replay
+ */
+uint64_t i2c_time(void)
+{
+    uint64_t time;
+    if (mode != MODE_REPLAY || replay_speed != I2C_REPLAY_FAST)
+    {
+        return monotonic_ns();
+    }
+    pthread_mutex_lock(&lock);
+    time = trace_clock;
+    pthread_mutex_unlock(&lock);
+    return time;
+}
+
+/*
+ * Writes how many transfers were traced or replayed to `out`, and for replays
+ * how many reads found no traced response
+ */
+void print_i2c_stats(FILE* out)
+{
+    pthread_mutex_lock(&lock);
+    if (mode == MODE_TRACE)
+    {
+        fprintf(out, "i2c trace: transfers=%lu lost=%lu%s\n", transfers, lost,
+            write_failed ? " write failed" : "");
+    }
+    else if (mode == MODE_REPLAY)
+    {
+        fprintf(out, "i2c replay: transfers=%lu misses=%lu\n", transfers,
+            misses);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Flushes and closes the trace being written or replayed. Returns zero on
+ * success, and a negative value if traced records could not all be written
+ */
+int close_i2c_trace(void)
+{
+    int ret = 0;
+    if (mode == MODE_TRACE)
+    {
+        pthread_mutex_lock(&lock);
+        trace_stopping = 1;
+        pthread_cond_signal(&trace_wake);
+        pthread_mutex_unlock(&lock);
+        pthread_join(trace_writer, NULL);
+        if (fclose(trace_file) != 0) write_failed = 1;
+        ret = write_failed ? -1 : lost ? -2 : 0;
+        pthread_cond_destroy(&trace_wake);
+        free(batch_memory);
+        batch_memory = NULL;
+    }
+
+    pthread_mutex_lock(&lock);
+    if (records)
+    {
+        munmap((char*)records - sizeof(trace_header), mapped_size);
+    }
+    trace_file = NULL;
+    records = NULL;
+    record_count = 0;
+    key_count = 0;
+    batch_fill = 0;
+    trace_stopping = 0;
+    write_failed = 0;
+    transfers = 0;
+    misses = 0;
+    lost = 0;
+    mode = MODE_DIRECT;
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+/*
+ * Opens `bus` to talk to the device at `addr`. Returns the bus handle, and a
+ * negative value on errors
+ */
+int open_i2c_device(const char* bus, long addr)
+{
+    int fd;
+    if (mode == MODE_REPLAY)
+    {
+        return REPLAY_HANDLE;
+    }
+    fd = open(bus, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    // Transfers carry the address, this only fails if a driver claimed it
+    if (ioctl(fd, I2C_SLAVE, addr) != 0)
+    {
+        close(fd);
+        return -2;
+    }
+    return fd;
+}
+
+/*
+ * Writes `write_len` bytes of `out` to `addr`, then reads `read_len` bytes to
+ * `in` after a repeated start. Returns zero on success, and a negative value
+ * on errors or if more than I2C_MAX_TRANSFER bytes are involved
+ */
+int i2c_transfer(int bus, uint16_t addr, const uint8_t* out, int write_len,
+    uint8_t* in, int read_len)
+{
+    i2c_trace_record record = { 0 };
+    int ret;
+    if (write_len + read_len > I2C_MAX_TRANSFER)
+    {
+        return -1;
+    }
+    if (mode == MODE_DIRECT)
+    {
+        return bus_transfer(bus, addr, out, write_len, in, read_len);
+    }
+
+    if (mode == MODE_REPLAY)
+    {
+        pthread_mutex_lock(&lock);
+        transfers++;
+        ret = replay_transfer(addr, out, write_len, in, read_len);
+        pthread_mutex_unlock(&lock);
+        return ret;
+    }
+
+    ret = bus_transfer(bus, addr, out, write_len, in, read_len);
+    record.addr = addr;
+    record.write_len = write_len;
+    record.read_len = read_len;
+    record.result = ret == 0 ? 0 : -1;
+    memcpy(record.data, out, write_len);
+    if (ret == 0) memcpy(record.data + write_len, in, read_len);
+
+    // Only the copy is locked, timed here so records stay in order
+    pthread_mutex_lock(&lock);
+    transfers++;
+    record.time = monotonic_ns();
+    if (batch_fill == TRACE_BATCH)
+    {
+        lost++;
+    }
+    else
+    {
+        batches[0][batch_fill++] = record;
+    }
+    if (batch_fill == TRACE_BATCH / 2) pthread_cond_signal(&trace_wake);
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+/*
+ * Closes a bus handle from `open_i2c_device`
+ */
+void close_i2c_device(int bus)
+{
+    if (bus >= 0 && bus != REPLAY_HANDLE) close(bus);
+}
@@ -0,0 +1,91 @@
+/*
+ * Implements I2C transfers shared by the device drivers, which can be traced
+ * to a file and replayed from one instead of the bus
+ */
+
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define I2C_TRACE_MAGIC     0x54414747  // "GGAT" read little endian
+#define I2C_TRACE_VERSION   1
+#define I2C_MAX_TRANSFER    16          // Bytes written and read together
+#define I2C_REPLAY_KEYS     32          // Distinct requests a replay serves
+
+/*
+ * One traced transaction, host byte order. A write of `write_len` bytes is
+ * followed by a read of `read_len` after a repeated start, either may be empty
+ */
+typedef struct __attribute__((packed)) {
+    uint64_t time;              // CLOCK_MONOTONIC ns the transfer finished
+    uint16_t addr;
+    uint8_t write_len;
+    uint8_t read_len;
+    int8_t result;              // 0 on success, -1 if the transfer failed
+    uint8_t reserved[3];
+    uint8_t data[I2C_MAX_TRANSFER]; // Bytes written, then bytes read
+} i2c_trace_record;
+
+typedef enum {
+    I2C_REPLAY_REALTIME,        // Reads see the latest traced response
+    I2C_REPLAY_FAST,            // Reads step through responses in order
+} i2c_replay_speed;
+
+/*
+ * Logs every later transfer to `path`. Returns zero on success, and a negative
+ * value on errors
+ */
+int trace_i2c(const char* path);
+
+/*
+ * Serves every later transfer from the trace at `path` instead of the bus.
+ * Returns zero on success, and a negative value if the file cannot be read or
+ * is not a trace
+ */
+int replay_i2c(const char* path, i2c_replay_speed speed);
+
+/*
+ * Returns 1 once a fast replay ran out of responses, 0 otherwise
+ */
+int i2c_replay_done(void);
+
+/*
+ * Returns the CLOCK_MONOTONIC time in ns, or the time of the response served
+ * last during a fast replay
+ */
+uint64_t i2c_time(void);
+
+/*
+ * Writes how many transfers were traced or replayed to `out`, and for replays
+ * how many reads found no traced response
+ */
+void print_i2c_stats(FILE* out);
+
+/*
+ * Flushes and closes the trace being written or replayed. Returns zero on
+ * success, and a negative value if traced records could not all be written
+ */
+int close_i2c_trace(void);
+
+/*
+ * Opens `bus` to talk to the device at `addr`. Returns the bus handle, and a
+ * negative value on errors
+ */
+int open_i2c_device(const char* bus, long addr);
+
+/*
+ * Writes `write_len` bytes of `out` to `addr`, then reads `read_len` bytes to
+ * `in` after a repeated start. Returns zero on success, and a negative value
+ * on errors or if more than I2C_MAX_TRANSFER bytes are involved
+ */
+int i2c_transfer(int bus, uint16_t addr, const uint8_t* out, int write_len,
+    uint8_t* in, int read_len);
+
+/*
+ * Closes a bus handle from `open_i2c_device`
+ */
+void close_i2c_device(int bus);
+
+#endif
@@ -0,0 +1,260 @@
+/*
+ * Implements simulated input devices, either directly on /dev/uinput or through
+ * libevdev
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+
+#include "input_device.h"
+
+/*
+ * Allocates a device called `name` that is not yet visible to the system,
+ * returns NULL on error
+ */
+input_device* new_input_device(const char* name, input_backend backend)
+{
+    input_device* device = malloc(sizeof(input_device));
+    if (!device)
+    {
+        return NULL;
+    }
+    device->backend = backend;
+    device->fd = -1;
+    device->dev = NULL;
+    device->uidev = NULL;
+    device->frames = 0;
+    device->writes = 0;
+    memset(&device->setup, 0, sizeof(device->setup));
+    device->setup.id.bustype = BUS_VIRTUAL;
+    strncpy(device->setup.name, name, UINPUT_MAX_NAME_SIZE - 1);
+
+    if (backend == INPUT_BACKEND_LIBEVDEV)
+    {
+        device->dev = libevdev_new();
+        if (!device->dev)
+        {
+            free(device);
+            return NULL;
+        }
+        libevdev_set_name(device->dev, name);
+        libevdev_set_id_bustype(device->dev, BUS_VIRTUAL);
+        libevdev_enable_event_type(device->dev, EV_KEY);
+        libevdev_enable_event_code(device->dev, EV_MSC, MSC_TIMESTAMP, NULL);
+        return device;
+    }
+
+    device->fd = open(UINPUT_PATH, O_WRONLY | O_CLOEXEC);
+    if (device->fd < 0)
+    {
+        free(device);
+        return NULL;
+    }
+    if (ioctl(device->fd, UI_SET_EVBIT, EV_KEY) != 0
+        || ioctl(device->fd, UI_SET_EVBIT, EV_MSC) != 0
+        || ioctl(device->fd, UI_SET_MSCBIT, MSC_TIMESTAMP) != 0)
+    {
+        close_input_device(device);
+        return NULL;
+    }
+    return device;
+}
+
+/*
+ * Lets the device send EV_KEY events with `code`, must be called before
+ * `start_input_device`. Returns zero on success, and a negative value on errors
+ */
+int enable_device_key(input_device* device, unsigned int code)
+{
+    if (device->backend == INPUT_BACKEND_LIBEVDEV)
+    {
+        return libevdev_enable_event_code(device->dev, EV_KEY, code, NULL);
+    }
+    return ioctl(device->fd, UI_SET_KEYBIT, code);
+}
+
+/*
+ * Lets the device send EV_ABS events with `code` within `range`, must be
+ * called before `start_input_device`. Returns zero on success, and a negative
+ * value on errors
+ */
+int enable_device_axis(input_device* device, unsigned int code,
+    const axis_range* range)
+{
+    struct uinput_abs_setup abs;
+    memset(&abs, 0, sizeof(abs));
+    abs.code = code;
+    abs.absinfo.minimum = range->minimum;
+    abs.absinfo.maximum = range->maximum;
+    abs.absinfo.value = range->rest;
+
+    if (device->backend == INPUT_BACKEND_LIBEVDEV)
+    {
+        return libevdev_enable_event_code(device->dev, EV_ABS, code,
+            &abs.absinfo);
+    }
+    if (ioctl(device->fd, UI_SET_EVBIT, EV_ABS) != 0
+        || ioctl(device->fd, UI_SET_ABSBIT, code) != 0)
+    {
+        return -1;
+    }
+    return ioctl(device->fd, UI_ABS_SETUP, &abs);
+}
+
+/*
+ * Lets the device send EV_REL events with `code`, must be called before
+ * `start_input_device`. Returns zero on success, and a negative value on errors
+ */
+int enable_device_rel(input_device* device, unsigned int code)
+{
+    if (device->backend == INPUT_BACKEND_LIBEVDEV)
+    {
+        return libevdev_enable_event_code(device->dev, EV_REL, code, NULL);
+    }
+    if (ioctl(device->fd, UI_SET_EVBIT, EV_REL) != 0)
+    {
+        return -1;
+    }
+    return ioctl(device->fd, UI_SET_RELBIT, code);
+}
+
+/*
+ * Sets the bus type and USB style ids the device reports, must be called
+ * before `start_input_device`
+ */
+void set_device_id(input_device* device, uint16_t bustype, uint16_t vendor,
+    uint16_t product, uint16_t version)
+{
+    device->setup.id.bustype = bustype;
+    device->setup.id.vendor = vendor;
+    device->setup.id.product = product;
+    device->setup.id.version = version;
+    if (device->dev)
+    {
+        libevdev_set_id_bustype(device->dev, bustype);
+        libevdev_set_id_vendor(device->dev, vendor);
+        libevdev_set_id_product(device->dev, product);
+        libevdev_set_id_version(device->dev, version);
+    }
+}
+
+/*
+ * Fills `range` with the conventional range of axis `code`, sticks are signed
+ * 16 bit, triggers 0 to 255 and hats -1 to 1
+ */
+void default_axis_range(unsigned int code, axis_range* range)
+{
+    range->rest = 0;
+    if (code >= ABS_HAT0X && code <= ABS_HAT3Y)
+    {
+        range->minimum = -1;
+        range->maximum = 1;
+    }
+    else if (code == ABS_Z || code == ABS_RZ
+        || code == ABS_GAS || code == ABS_BRAKE)
+    {
+        range->minimum = 0;
+        range->maximum = 255;
+    }
+    else
+    {
+        range->minimum = -32767;
+        range->maximum = 32767;
+    }
+}
+
+/*
+ * Creates the device node, returns zero on success, and a negative value on
+ * errors
+ */
+int start_input_device(input_device* device)
+{
+    if (device->backend == INPUT_BACKEND_LIBEVDEV)
+    {
+        return libevdev_uinput_create_from_device(
+            device->dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &device->uidev);
+    }
+    if (ioctl(device->fd, UI_DEV_SETUP, &device->setup) != 0)
+    {
+        return -1;
+    }
+    return ioctl(device->fd, UI_DEV_CREATE);
+}
+
+/*
+ * Emits the `count` events followed by a SYN_REPORT as one frame. A non-zero
+ * `timestamp` (CLOCK_MONOTONIC ns of the physical event) is sent along as
+ * MSC_TIMESTAMP in microseconds. Returns zero on success, and a negative value
+ * on errors
+ */
+int emit_input_frame(input_device* device, const device_event* events,
+    int count, uint64_t timestamp)
+{
+    struct input_event frame[INPUT_FRAME_MAX + 2];
+    ssize_t len;
+    int n = 0;
+    if (count > INPUT_FRAME_MAX)
+    {
+        return -1;
+    }
+    device->frames++;
+
+    if (device->backend == INPUT_BACKEND_LIBEVDEV)
+    {
+        if (timestamp)
+        {
+            device->writes++;
+            libevdev_uinput_write_event(device->uidev, EV_MSC, MSC_TIMESTAMP,
+                (int32_t)(timestamp / 1000));
+        }
+        for (int i = 0; i < count; i++)
+        {
+            device->writes++;
+            libevdev_uinput_write_event(device->uidev,
+                events[i].type, events[i].code, events[i].value);
+        }
+        device->writes++;
+        return libevdev_uinput_write_event(
+            device->uidev, EV_SYN, SYN_REPORT, 0);
+    }
+
+    // Build the whole frame on the stack and hand it over in one syscall
+    memset(frame, 0, (count + 2) * sizeof(struct input_event));
+    if (timestamp)
+    {
+        frame[n].type = EV_MSC;
+        frame[n].code = MSC_TIMESTAMP;
+        frame[n].value = (int32_t)(timestamp / 1000);
+        n++;
+    }
+    for (int i = 0; i < count; i++, n++)
+    {
+        frame[n].type = events[i].type;
+        frame[n].code = events[i].code;
+        frame[n].value = events[i].value;
+    }
+    frame[n].type = EV_SYN;
+    frame[n].code = SYN_REPORT;
+    len = (n + 1) * sizeof(struct input_event);
+    device->writes++;
+    return write(device->fd, frame, len) == len ? 0 : -2;
+}
+
+/*
+ * Removes the device node and frees memory
+ */
+void close_input_device(input_device* device)
+{
+    if (device->uidev) libevdev_uinput_destroy(device->uidev);
+    if (device->dev) libevdev_free(device->dev);
+    if (device->fd >= 0)
+    {
+        ioctl(device->fd, UI_DEV_DESTROY);
+        close(device->fd);
+    }
+    free(device);
+}
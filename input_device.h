@@ -0,0 +1,110 @@
+/*
+ * Implements simulated input devices, either directly on /dev/uinput or through
+ * libevdev
+ */
+
+#ifndef INPUT_DEVICE_H
+#define INPUT_DEVICE_H
+
+#include <stdint.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <libevdev/libevdev.h>
+#include <libevdev/libevdev-uinput.h>
+
+#define UINPUT_PATH         "/dev/uinput"
+#define INPUT_FRAME_MAX     128
+
+typedef enum {
+    INPUT_BACKEND_UINPUT,   // One write() per frame
+    INPUT_BACKEND_LIBEVDEV, // One write() per event
+} input_backend;
+
+/*
+ * A single event to emit, the timestamp is filled in by the kernel
+ */
+typedef struct {
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+} device_event;
+
+/*
+ * Value range of an absolute axis, `rest` is reported while nothing drives it
+ */
+typedef struct {
+    int32_t minimum;
+    int32_t maximum;
+    int32_t rest;
+} axis_range;
+
+typedef struct {
+    input_backend backend;
+    int fd;
+    struct uinput_setup setup;  // Name and id, applied on start
+    struct libevdev* dev;
+    struct libevdev_uinput* uidev;
+    unsigned long frames;       // Frames emitted
+    unsigned long writes;       // write() calls made emitting them
+} input_device;
+
+/*
+ * Allocates a device called `name` that is not yet visible to the system,
+ * returns NULL on error
+ */
+input_device* new_input_device(const char* name, input_backend backend);
+
+/*
+ * Lets the device send EV_KEY events with `code`, must be called before
+ * `start_input_device`. Returns zero on success, and a negative value on errors
+ */
+int enable_device_key(input_device* device, unsigned int code);
+
+/*
+ * Lets the device send EV_ABS events with `code` within `range`, must be
+ * called before `start_input_device`. Returns zero on success, and a negative
+ * value on errors
+ */
+int enable_device_axis(input_device* device, unsigned int code,
+    const axis_range* range);
+
+/*
+ * Lets the device send EV_REL events with `code`, must be called before
+ * `start_input_device`. Returns zero on success, and a negative value on errors
+ */
+int enable_device_rel(input_device* device, unsigned int code);
+
+/*
+ * Sets the bus type and USB style ids the device reports, must be called
+ * before `start_input_device`
+ */
+void set_device_id(input_device* device, uint16_t bustype, uint16_t vendor,
+    uint16_t product, uint16_t version);
+
+/*
+ * Fills `range` with the conventional range of axis `code`, sticks are signed
+ * 16 bit, triggers 0 to 255 and hats -1 to 1
+ */
+void default_axis_range(unsigned int code, axis_range* range);
+
+/*
+ * Creates the device node, returns zero on success, and a negative value on
+ * errors
+ */
+int start_input_device(input_device* device);
+
+/*
+ * Emits the `count` events followed by a SYN_REPORT as one frame. A non-zero
+ * `timestamp` (CLOCK_MONOTONIC ns of the physical event) is sent along as
+ * MSC_TIMESTAMP in microseconds. Returns zero on success, and a negative value
+ * on errors
+ */
+int emit_input_frame(input_device* device, const device_event* events,
+    int count, uint64_t timestamp);
+
+/*
+ * Removes the device node and frees memory
+ */
+void close_input_device(input_device* device);
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * Implements recording raw button states to a file and replaying them on the
+ * recorded schedule
+ */
+
+#include <string.h>
+#include <endian.h>
+
+#include "input_record.h"
+
+// Buffered so the input loop only writes every few thousand entries
+#define RECORD_BUFFER_SIZE  (64 * 1024)
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t players;
+} record_header;
+
+/*
+ * Private helper functions
+ */
+static int write_entry(input_recorder* rec, uint32_t delta_us, int player,
+    arcade_buttons state)
+{
+    // Little endian on disk, so recordings move between machines
+    input_record entry = { htole32(delta_us), htole16(state), player, 0 };
+    rec->records++;
+    return fwrite(&entry, sizeof(entry), 1, rec->file) == 1 ? 0 : -1;
+}
+
+/*
+ * Starts recording to `path` the states of `players` players, which are
+ * `states` at `now` (CLOCK_MONOTONIC ns). Returns zero on success, and a
+ * negative value on errors
+ */
+int open_input_recorder(input_recorder* rec, const char* path, int players,
+    const arcade_buttons* states, uint64_t now)
+{
+    record_header header = { htole32(INPUT_RECORD_MAGIC),
+        htole16(INPUT_RECORD_VERSION), htole16(players) };
+    memset(rec, 0, sizeof(input_recorder));
+    rec->file = fopen(path, "wb");
+    if (!rec->file)
+    {
+        return -1;
+    }
+    setvbuf(rec->file, NULL, _IOFBF, RECORD_BUFFER_SIZE);
+    if (fwrite(&header, sizeof(header), 1, rec->file) != 1)
+    {
+        close_input_recorder(rec);
+        return -2;
+    }
+    rec->time = now;
+    rec->players = players;
+    for (int p = 0; p < players; p++)
+    {
+        rec->last[p] = states[p];
+        if (write_entry(rec, 0, p, states[p]) != 0)
+        {
+            close_input_recorder(rec);
+            return -2;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Records the raw `state` of `player` (0 for player 1) read at `time`, unless
+ * it did not change. Writes are buffered, so this does not touch the disk on
+ * every change. Returns zero on success, and a negative value on errors
+ */
+int record_input(input_recorder* rec, int player, arcade_buttons state,
+    uint64_t time)
+{
+    uint64_t delta_us;
+    if (!rec->file || player >= rec->players || state == rec->last[player])
+    {
+        return 0;
+    }
+
+    // Players are read in turn, so a later entry may carry an earlier time
+    delta_us = time > rec->time ? (time - rec->time) / 1000 : 0;
+    // Whole microseconds are kept, so rounding never adds up to drift
+    rec->time += delta_us * 1000;
+    // Gaps too long for one entry are bridged by repeating the old state
+    while (delta_us > UINT32_MAX)
+    {
+        if (write_entry(rec, UINT32_MAX, player, rec->last[player]) != 0)
+        {
+            return -1;
+        }
+        delta_us -= UINT32_MAX;
+    }
+    rec->last[player] = state;
+    return write_entry(rec, delta_us, player, state);
+}
+
+/*
+ * Flushes and closes the recording
+ */
+void close_input_recorder(input_recorder* rec)
+{
+    if (rec->file) fclose(rec->file);
+    rec->file = NULL;
+}
+
+/*
+ * Opens the recording at `path` with its time 0 at `start` (CLOCK_MONOTONIC
+ * ns), and reads its first entry. Returns zero on success, and a negative
+ * value if the file cannot be read or is not a recording
+ */
+int open_input_replay(input_replay* replay, const char* path, uint64_t start)
+{
+    record_header header;
+    memset(replay, 0, sizeof(input_replay));
+    reset_histogram(&replay->start_error);
+    reset_histogram(&replay->emit_error);
+    replay->file = fopen(path, "rb");
+    if (!replay->file)
+    {
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, replay->file) != 1
+        || le32toh(header.magic) != INPUT_RECORD_MAGIC
+        || le16toh(header.version) != INPUT_RECORD_VERSION)
+    {
+        close_input_replay(replay);
+        return -2;
+    }
+    // The first entry is due at `start` itself
+    replay->players = le16toh(header.players);
+    replay->due = start;
+    if (advance_input_replay(replay) != 1)
+    {
+        close_input_replay(replay);
+        return -3;
+    }
+    return 0;
+}
+
+/*
+ * Reads the entry after the current one. Returns 1 if there is one, 0 at the
+ * end of the recording, which sets `due` to 0, and a negative value if the
+ * file is cut short
+ */
+int advance_input_replay(input_replay* replay)
+{
+    input_record entry;
+    size_t read = fread(&entry, 1, sizeof(entry), replay->file);
+    if (read != sizeof(entry))
+    {
+        replay->due = 0;
+        return read == 0 ? 0 : -1;
+    }
+    replay->due += le32toh(entry.delta_us) * 1000ULL;
+    replay->player = entry.player;
+    replay->state = (arcade_buttons)le16toh(entry.state);
+    return 1;
+}
+
+/*
+ * Writes how far from schedule the replayed entries were fed in and sent
+ */
+void print_replay_report(FILE* out, const input_replay* replay)
+{
+    fprintf(out, "replay: entries=%lu\n", replay->replayed);
+    print_histogram(out, "replay scheduled to fed in", &replay->start_error);
+    print_histogram(out, "replay scheduled to sent", &replay->emit_error);
+}
+
+/*
+ * Closes the recording
+ */
+void close_input_replay(input_replay* replay)
+{
+    if (replay->file) fclose(replay->file);
+    replay->file = NULL;
+}
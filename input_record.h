@@ -0,0 +1,94 @@
+/*
+ * Implements recording raw button states to a file and replaying them on the
+ * recorded schedule
+ */
+
+#ifndef INPUT_RECORD_H
+#define INPUT_RECORD_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arcade_buttons.h"
+#include "histogram.h"
+
+#define INPUT_RECORD_MAGIC      0x52414747  // "GGAR" read little endian
+#define INPUT_RECORD_VERSION    1
+
+/*
+ * One entry of a recording, all fields little endian on disk and converted
+ * when written and read. A recording starts with the state of every player at
+ * time 0
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t delta_us;          // Time since the previous entry
+    uint16_t state;             // Raw arcade_buttons, a set bit is released
+    uint8_t player;             // 0 is player 1
+    uint8_t reserved;
+} input_record;
+
+typedef struct {
+    FILE* file;
+    uint64_t time;              // CLOCK_MONOTONIC ns of the previous entry
+    int players;
+    arcade_buttons last[ARCADE_BONNETS_MAX];
+    unsigned long records;
+} input_recorder;
+
+typedef struct {
+    FILE* file;
+    int players;                // Players in the recording
+    uint64_t due;               // CLOCK_MONOTONIC ns the next entry is due
+    int player;                 // Next entry, valid while `due` is not 0
+    arcade_buttons state;
+    unsigned long replayed;
+    histogram start_error;      // Time an entry was fed in minus `due`
+    histogram emit_error;       // Time it was handled, frames sent, minus `due`
+} input_replay;
+
+/*
+ * Starts recording to `path` the states of `players` players, which are
+ * `states` at `now` (CLOCK_MONOTONIC ns). Returns zero on success, and a
+ * negative value on errors
+ */
+int open_input_recorder(input_recorder* rec, const char* path, int players,
+    const arcade_buttons* states, uint64_t now);
+
+/*
+ * Records the raw `state` of `player` (0 for player 1) read at `time`, unless
+ * it did not change. Writes are buffered, so this does not touch the disk on
+ * every change. Returns zero on success, and a negative value on errors
+ */
+int record_input(input_recorder* rec, int player, arcade_buttons state,
+    uint64_t time);
+
+/*
+ * Flushes and closes the recording
+ */
+void close_input_recorder(input_recorder* rec);
+
+/*
+ * Opens the recording at `path` with its time 0 at `start` (CLOCK_MONOTONIC
+ * ns), and reads its first entry. Returns zero on success, and a negative
+ * value if the file cannot be read or is not a recording
+ */
+int open_input_replay(input_replay* replay, const char* path, uint64_t start);
+
+/*
+ * Reads the entry after the current one. Returns 1 if there is one, 0 at the
+ * end of the recording, which sets `due` to 0, and a negative value if the
+ * file is cut short
+ */
+int advance_input_replay(input_replay* replay);
+
+/*
+ * Writes how far from schedule the replayed entries were fed in and sent
+ */
+void print_replay_report(FILE* out, const input_replay* replay);
+
+/*
+ * Closes the recording
+ */
+void close_input_replay(input_replay* replay);
+
+#endif
@@ -0,0 +1,470 @@
+/*
+ * Implements the table mapping arcade bonnet buttons to simulated key codes
+ * and axis directions
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "keymap.h"
+#include "config.h"
+
+#define KEY(code)           { EV_KEY, code, 0 }
+#define AXIS(code, dir)     { EV_ABS, code, dir }
+#define MOTION(code, dir)   { EV_REL, code, dir }
+
+// Button names by bit, bits 6 and 7 (GPA6/GPA7) are not wired
+static const char* BUTTON_NAMES[KEYMAP_BUTTONS] = {
+    "BUTTON_1A", "BUTTON_1B", "BUTTON_1C", "BUTTON_1D",
+    "BUTTON_1E", "BUTTON_1F", NULL, NULL,
+    "PAD_DOWN", "PAD_UP", "PAD_RIGHT", "PAD_LEFT",
+    "STICK_RIGHT", "STICK_LEFT", "STICK_DOWN", "STICK_UP",
+};
+
+// Built in key codes, commented with the console control each pin is wired to
+static const keymap_entry DEFAULT_KEYS[KEYMAP_BUTTONS] = {
+    [0]  = { 1, { KEY(KEY_LEFTCTRL) } },    // BUTTON_1A: SELECT
+    [1]  = { 1, { KEY(KEY_S) } },           // BUTTON_1B: START
+    [2]  = { 1, { KEY(KEY_ENTER) } },       // BUTTON_1C: A
+    [3]  = { 1, { KEY(KEY_TAB) } },         // BUTTON_1D: Y
+    [4]  = { 1, { KEY(KEY_ESC) } },         // BUTTON_1E: B
+    [5]  = { 1, { KEY(KEY_SPACE) } },       // BUTTON_1F: X
+    [8]  = { 1, { KEY(KEY_9) } },           // PAD_DOWN: RB
+    [9]  = { 1, { KEY(KEY_2) } },           // PAD_UP: RT
+    [10] = { 1, { KEY(KEY_1) } },           // PAD_RIGHT: LT
+    [11] = { 1, { KEY(KEY_8) } },           // PAD_LEFT: LB
+    [12] = { 1, { KEY(KEY_UP) } },          // STICK_RIGHT: stick up
+    [13] = { 1, { KEY(KEY_DOWN) } },        // STICK_LEFT: stick down
+    [14] = { 1, { KEY(KEY_RIGHT) } },       // STICK_DOWN: stick right
+    [15] = { 1, { KEY(KEY_LEFT) } },        // STICK_UP: stick left
+};
+
+// Built in gamepad codes, triggers press a button and pull the analog axis
+static const keymap_entry DEFAULT_GAMEPAD[KEYMAP_BUTTONS] = {
+    [0]  = { 1, { KEY(BTN_SELECT) } },
+    [1]  = { 1, { KEY(BTN_START) } },
+    [2]  = { 1, { KEY(BTN_SOUTH) } },
+    [3]  = { 1, { KEY(BTN_NORTH) } },
+    [4]  = { 1, { KEY(BTN_EAST) } },
+    [5]  = { 1, { KEY(BTN_WEST) } },
+    [8]  = { 1, { KEY(BTN_TR) } },
+    [9]  = { 2, { KEY(BTN_TR2), AXIS(ABS_RZ, 1) } },
+    [10] = { 2, { KEY(BTN_TL2), AXIS(ABS_Z, 1) } },
+    [11] = { 1, { KEY(BTN_TL) } },
+    [12] = { 1, { AXIS(ABS_HAT0Y, -1) } },
+    [13] = { 1, { AXIS(ABS_HAT0Y, 1) } },
+    [14] = { 1, { AXIS(ABS_HAT0X, 1) } },
+    [15] = { 1, { AXIS(ABS_HAT0X, -1) } },
+};
+
+// Built in mouse buttons, the stick moves the pointer
+static const keymap_entry DEFAULT_MOUSE[KEYMAP_BUTTONS] = {
+    [2]  = { 1, { KEY(BTN_LEFT) } },        // BUTTON_1C: A
+    [4]  = { 1, { KEY(BTN_RIGHT) } },       // BUTTON_1E: B
+    [12] = { 1, { MOTION(REL_Y, -1) } },
+    [13] = { 1, { MOTION(REL_Y, 1) } },
+    [14] = { 1, { MOTION(REL_X, 1) } },
+    [15] = { 1, { MOTION(REL_X, -1) } },
+};
+
+static const keymap_entry* DEFAULTS[KEYMAP_LAYOUTS] = {
+    [KEYMAP_KEYBOARD] = DEFAULT_KEYS,
+    [KEYMAP_GAMEPAD] = DEFAULT_GAMEPAD,
+    [KEYMAP_MOUSE] = DEFAULT_MOUSE,
+};
+static const char* LAYOUT_NAMES[KEYMAP_LAYOUTS] = {
+    "keyboard", "gamepad", "mouse",
+};
+
+/*
+ * Codes every gamepad reports whether mapped or not, so the button and axis
+ * numbering SDL derives from them matches the controller database entry
+ */
+static const unsigned int GAMEPAD_KEYS[] = {
+    BTN_SOUTH, BTN_EAST, BTN_NORTH, BTN_WEST, BTN_TL, BTN_TR, BTN_TL2,
+    BTN_TR2, BTN_SELECT, BTN_START, BTN_MODE, BTN_THUMBL, BTN_THUMBR,
+};
+static const unsigned int GAMEPAD_AXES[] = {
+    ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ, ABS_HAT0X, ABS_HAT0Y,
+};
+
+// Codes that make a device classify as a mouse
+static const unsigned int MOUSE_KEYS[] = { BTN_LEFT, BTN_RIGHT, BTN_MIDDLE };
+static const unsigned int MOUSE_RELS[] = { REL_X, REL_Y, REL_WHEEL };
+
+/*
+ * Private helper functions
+ */
+static int parse_output(char* name, keymap_output* output)
+{
+    size_t len = strlen(name);
+    char* end;
+    int code = libevdev_event_code_from_name(EV_KEY, name);
+    if (code >= 0)
+    {
+        *output = (keymap_output)KEY(code);
+        return 0;
+    }
+
+    // Axis directions are written as ABS_HAT0X-, ABS_Z+ or REL_X-
+    if (len > 1 && (name[len - 1] == '-' || name[len - 1] == '+'))
+    {
+        int direction = name[len - 1] == '-' ? -1 : 1;
+        name[len - 1] = '\0';
+        code = libevdev_event_code_from_name(EV_ABS, name);
+        if (code >= 0)
+        {
+            *output = (keymap_output)AXIS(code, direction);
+            return 0;
+        }
+        code = libevdev_event_code_from_name(EV_REL, name);
+        if (code >= 0)
+        {
+            *output = (keymap_output)MOTION(code, direction);
+            return 0;
+        }
+        return -1;
+    }
+
+    code = strtol(name, &end, 0);
+    if (*end != '\0' || code <= 0 || code > KEY_MAX)
+    {
+        return -1;
+    }
+    *output = (keymap_output)KEY(code);
+    return 0;
+}
+
+static int rebuild_axes(keymap* map)
+{
+    map->axis_count = 0;
+    map->motion = 0;
+    for (int i = 0; i < KEYMAP_BUTTONS; i++)
+    {
+        for (unsigned int k = 0; k < map->buttons[i].count; k++)
+        {
+            const keymap_output* output = &map->buttons[i].outputs[k];
+            int a;
+            if (output->type == EV_KEY)
+            {
+                continue;
+            }
+            for (a = 0; a < map->axis_count; a++)
+            {
+                if (map->axes[a].type == output->type
+                    && map->axes[a].code == output->code) break;
+            }
+            if (a == map->axis_count)
+            {
+                if (a == KEYMAP_MAX_AXES)
+                {
+                    return -1;
+                }
+                memset(&map->axes[a], 0, sizeof(keymap_axis));
+                map->axes[a].type = output->type;
+                map->axes[a].code = output->code;
+                default_axis_range(output->code, &map->axes[a].range);
+                map->axis_count++;
+            }
+            if (output->type == EV_REL) map->motion |= 1 << i;
+            if (output->direction < 0)
+            {
+                map->axes[a].negative |= 1 << i;
+            }
+            else
+            {
+                map->axes[a].positive |= 1 << i;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Fills `map` with the built in assignments for `layout`
+ */
+void default_keymap(keymap* map, keymap_layout layout)
+{
+    const keymap_entry* defaults = DEFAULTS[layout];
+    map->layout = layout;
+    map->enabled = 0;
+    for (int i = 0; i < KEYMAP_BUTTONS; i++)
+    {
+        map->buttons[i] = defaults[i];
+        if (map->buttons[i].count) map->enabled |= 1 << i;
+    }
+    rebuild_axes(map);
+}
+
+/*
+ * Names `profile` and fills its keymaps with the built in assignments. Returns
+ * zero on success, and a negative value if the name is too long
+ */
+int default_keymap_profile(keymap_profile* profile, const char* name)
+{
+    if (strlen(name) >= KEYMAP_PROFILE_NAME)
+    {
+        return -1;
+    }
+    strcpy(profile->name, name);
+    profile->configured = 0;
+    for (int i = 0; i < KEYMAP_LAYOUTS; i++)
+    {
+        default_keymap(&profile->maps[i], i);
+    }
+    return 0;
+}
+
+/*
+ * Copies the keymaps of `base` into `profile` for the layouts the profile did
+ * not configure itself
+ */
+void inherit_keymap_profile(keymap_profile* profile,
+    const keymap_profile* base)
+{
+    for (int i = 0; i < KEYMAP_LAYOUTS; i++)
+    {
+        if (!(profile->configured & (1 << i)))
+        {
+            profile->maps[i] = base->maps[i];
+        }
+    }
+}
+
+/*
+ * Assigns the whitespace separated outputs in `value` to the button called
+ * `button` (BUTTON_1A, PAD_UP, ...). Outputs are key names (KEY_ENTER,
+ * BTN_SOUTH, ...), numeric key codes, or axis names with a direction
+ * (ABS_HAT0X-, ABS_Z+, REL_X-). A value of "disabled" turns the button off.
+ * Returns zero on success, and a negative value on an unknown button or output
+ */
+int configure_keymap(keymap* map, const char* button, const char* value)
+{
+    keymap_entry entry, previous;
+    int index = keymap_button_index(button);
+    if (index < 0)
+    {
+        return -1;
+    }
+    if (parse_keymap_entry(value, &entry) != 0)
+    {
+        return -2;
+    }
+
+    previous = map->buttons[index];
+    map->buttons[index] = entry;
+    if (rebuild_axes(map) != 0)
+    {
+        // Too many distinct axes, keep the map as it was
+        map->buttons[index] = previous;
+        rebuild_axes(map);
+        return -3;
+    }
+    if (entry.count)
+    {
+        map->enabled |= 1 << index;
+    }
+    else
+    {
+        map->enabled &= ~(1 << index);
+    }
+    return 0;
+}
+
+/*
+ * Parses the whitespace separated outputs in `value`, as taken by
+ * `configure_keymap`, into `entry`. Returns zero on success, and a negative
+ * value on an unknown output
+ */
+int parse_keymap_entry(const char* value, keymap_entry* entry)
+{
+    char buf[CONFIG_LINE_LEN], *names[KEYMAP_MAX_KEYS];
+    int count;
+    strncpy(buf, value, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    count = split_config_value(buf, names, KEYMAP_MAX_KEYS);
+    if (count <= 0)
+    {
+        return -1;
+    }
+
+    memset(entry, 0, sizeof(keymap_entry));
+    if (count == 1 && strcmp(names[0], "disabled") == 0)
+    {
+        return 0;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (parse_output(names[i], &entry->outputs[entry->count++]) != 0)
+        {
+            return -2;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns the bit of the button called `name`, or a negative value if there is
+ * no such button
+ */
+int keymap_button_index(const char* name)
+{
+    for (int index = 0; index < KEYMAP_BUTTONS; index++)
+    {
+        if (BUTTON_NAMES[index] && strcmp(BUTTON_NAMES[index], name) == 0)
+        {
+            return index;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Returns the name of the button at bit `index`, or NULL if it is not wired
+ */
+const char* keymap_button_name(int index)
+{
+    return BUTTON_NAMES[index];
+}
+
+/*
+ * Returns the name of `layout`, as used for its device in the configuration
+ */
+const char* keymap_layout_name(keymap_layout layout)
+{
+    return LAYOUT_NAMES[layout];
+}
+
+/*
+ * Lets `device` send every output used by `map`, returns zero on success, and
+ * a negative value on errors
+ */
+int enable_keymap_outputs(const keymap* map, input_device* device)
+{
+    const size_t gamepad_keys = sizeof(GAMEPAD_KEYS) / sizeof(GAMEPAD_KEYS[0]);
+    const size_t gamepad_axes = sizeof(GAMEPAD_AXES) / sizeof(GAMEPAD_AXES[0]);
+    const size_t mouse_keys = sizeof(MOUSE_KEYS) / sizeof(MOUSE_KEYS[0]);
+    const size_t mouse_rels = sizeof(MOUSE_RELS) / sizeof(MOUSE_RELS[0]);
+    axis_range range;
+    if (map->layout == KEYMAP_MOUSE)
+    {
+        for (size_t i = 0; i < mouse_keys; i++)
+        {
+            if (enable_device_key(device, MOUSE_KEYS[i]) != 0) return -1;
+        }
+        for (size_t i = 0; i < mouse_rels; i++)
+        {
+            if (enable_device_rel(device, MOUSE_RELS[i]) != 0) return -1;
+        }
+    }
+    if (map->layout == KEYMAP_GAMEPAD)
+    {
+        for (size_t i = 0; i < gamepad_keys; i++)
+        {
+            if (enable_device_key(device, GAMEPAD_KEYS[i]) != 0) return -1;
+        }
+        for (size_t i = 0; i < gamepad_axes; i++)
+        {
+            default_axis_range(GAMEPAD_AXES[i], &range);
+            if (enable_device_axis(device, GAMEPAD_AXES[i], &range) != 0)
+            {
+                return -1;
+            }
+        }
+    }
+    for (int i = 0; i < KEYMAP_BUTTONS; i++)
+    {
+        for (unsigned int k = 0; k < map->buttons[i].count; k++)
+        {
+            const keymap_output* output = &map->buttons[i].outputs[k];
+            if (output->type == EV_KEY
+                && enable_device_key(device, output->code) != 0)
+            {
+                return -1;
+            }
+        }
+    }
+    for (int a = 0; a < map->axis_count; a++)
+    {
+        const keymap_axis* axis = &map->axes[a];
+        int ret = axis->type == EV_REL
+            ? enable_device_rel(device, axis->code)
+            : enable_device_axis(device, axis->code, &axis->range);
+        if (ret != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns the direction, -1, 0 or 1, that the buttons held in `state` push
+ * relative axis `code` in
+ */
+int keymap_rel_direction(const keymap* map, arcade_buttons state,
+    uint16_t code)
+{
+    unsigned int held = ~state;
+    for (int a = 0; a < map->axis_count; a++)
+    {
+        const keymap_axis* axis = &map->axes[a];
+        if (axis->type == EV_REL && axis->code == code)
+        {
+            return ((held & axis->positive) != 0)
+                - ((held & axis->negative) != 0);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Writes the events for the transition from `last` to `curr` to `events`,
+ * which must hold KEYMAP_MAX_EVENTS entries, visiting only the changed bits.
+ * Returns the number of events written
+ */
+int keymap_events(const keymap* map, arcade_buttons last, arcade_buttons curr,
+    device_event* events)
+{
+    unsigned int changed = (last ^ curr) & map->enabled, changes = changed;
+    // Inputs are pulled up, a cleared bit is a pressed button
+    unsigned int held = ~curr;
+    int count = 0;
+    while (changes)
+    {
+        int index = __builtin_ctz(changes);
+        const keymap_entry* entry = &map->buttons[index];
+        int pressed = (held >> index) & 1;
+        changes &= changes - 1;
+        for (unsigned int i = 0; i < entry->count; i++)
+        {
+            if (entry->outputs[i].type != EV_KEY)
+            {
+                continue;
+            }
+            events[count].type = EV_KEY;
+            events[count].code = entry->outputs[i].code;
+            events[count].value = pressed;
+            count++;
+        }
+    }
+
+    // Axes settle on the direction still held, opposite directions cancel
+    for (int a = 0; a < map->axis_count; a++)
+    {
+        const keymap_axis* axis = &map->axes[a];
+        int negative = (held & axis->negative) != 0;
+        int positive = (held & axis->positive) != 0;
+        if (axis->type != EV_ABS
+            || !(changed & (axis->negative | axis->positive)))
+        {
+            continue;
+        }
+        events[count].type = EV_ABS;
+        events[count].code = axis->code;
+        events[count].value = negative == positive ? axis->range.rest
+            : negative ? axis->range.minimum : axis->range.maximum;
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,146 @@
+/*
+ * Implements the table mapping arcade bonnet buttons to simulated key codes
+ * and axis directions
+ */
+
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include <stdint.h>
+
+#include "arcade_buttons.h"
+#include "input_device.h"
+
+#define KEYMAP_BUTTONS      16
+#define KEYMAP_MAX_KEYS     4
+#define KEYMAP_MAX_AXES     8
+#define KEYMAP_MAX_EVENTS   (KEYMAP_BUTTONS * KEYMAP_MAX_KEYS)
+#define KEYMAP_PROFILES     8
+#define KEYMAP_PROFILE_NAME 32
+
+typedef enum {
+    KEYMAP_KEYBOARD,
+    KEYMAP_GAMEPAD,
+    KEYMAP_MOUSE,
+    KEYMAP_LAYOUTS,             // Number of layouts
+} keymap_layout;
+
+/*
+ * One output of a button, a key or one direction of an axis
+ */
+typedef struct {
+    uint16_t type;              // EV_KEY, EV_ABS or EV_REL
+    uint16_t code;
+    int16_t direction;          // Axes only, -1 or 1
+} keymap_output;
+
+/*
+ * Outputs of one button, indexed by its bit in `arcade_buttons`
+ */
+typedef struct {
+    unsigned int count;
+    keymap_output outputs[KEYMAP_MAX_KEYS];
+} keymap_entry;
+
+/*
+ * An axis driven by buttons, precomputed from the entries. Absolute axes are
+ * sent on button changes, relative ones by the pointer motion timer
+ */
+typedef struct {
+    uint16_t type;
+    uint16_t code;
+    uint16_t negative;          // Buttons pushing towards the minimum
+    uint16_t positive;          // Buttons pushing towards the maximum
+    axis_range range;
+} keymap_axis;
+
+typedef struct {
+    keymap_layout layout;
+    uint16_t enabled;           // Bits of buttons that send anything
+    uint16_t motion;            // Bits of buttons driving relative axes
+    keymap_entry buttons[KEYMAP_BUTTONS];
+    int axis_count;
+    keymap_axis axes[KEYMAP_MAX_AXES];
+} keymap;
+
+/*
+ * A named set of keymaps, one per layout, switched in and out as a whole
+ */
+typedef struct {
+    char name[KEYMAP_PROFILE_NAME];
+    unsigned int configured;    // Bits of layouts set by the profile itself
+    keymap maps[KEYMAP_LAYOUTS];
+} keymap_profile;
+
+/*
+ * Fills `map` with the built in assignments for `layout`
+ */
+void default_keymap(keymap* map, keymap_layout layout);
+
+/*
+ * Names `profile` and fills its keymaps with the built in assignments. Returns
+ * zero on success, and a negative value if the name is too long
+ */
+int default_keymap_profile(keymap_profile* profile, const char* name);
+
+/*
+ * Copies the keymaps of `base` into `profile` for the layouts the profile did
+ * not configure itself
+ */
+void inherit_keymap_profile(keymap_profile* profile,
+    const keymap_profile* base);
+
+/*
+ * Assigns the whitespace separated outputs in `value` to the button called
+ * `button` (BUTTON_1A, PAD_UP, ...). Outputs are key names (KEY_ENTER,
+ * BTN_SOUTH, ...), numeric key codes, or axis names with a direction
+ * (ABS_HAT0X-, ABS_Z+, REL_X-). A value of "disabled" turns the button off.
+ * Returns zero on success, and a negative value on an unknown button or output
+ */
+int configure_keymap(keymap* map, const char* button, const char* value);
+
+/*
+ * Parses the whitespace separated outputs in `value`, as taken by
+ * `configure_keymap`, into `entry`. Returns zero on success, and a negative
+ * value on an unknown output
+ */
+int parse_keymap_entry(const char* value, keymap_entry* entry);
+
+/*
+ * Returns the bit of the button called `name`, or a negative value if there is
+ * no such button
+ */
+int keymap_button_index(const char* name);
+
+/*
+ * Returns the name of the button at bit `index`, or NULL if it is not wired
+ */
+const char* keymap_button_name(int index);
+
+/*
+ * Returns the name of `layout`, as used for its device in the configuration
+ */
+const char* keymap_layout_name(keymap_layout layout);
+
+/*
+ * Lets `device` send every output used by `map`, returns zero on success, and
+ * a negative value on errors
+ */
+int enable_keymap_outputs(const keymap* map, input_device* device);
+
+/*
+ * Returns the direction, -1, 0 or 1, that the buttons held in `state` push
+ * relative axis `code` in
+ */
+int keymap_rel_direction(const keymap* map, arcade_buttons state,
+    uint16_t code);
+
+/*
+ * Writes the events for the transition from `last` to `curr` to `events`,
+ * which must hold KEYMAP_MAX_EVENTS entries, visiting only the changed bits.
+ * Returns the number of events written
+ */
+int keymap_events(const keymap* map, arcade_buttons last, arcade_buttons curr,
+    device_event* events);
+
+#endif
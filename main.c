@@ -2,6 +2,10 @@
  * Main function code for GGA hardware functions: buttons and battery
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE             // CPU_SETSIZE
+#endif
+
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -10,15 +14,37 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <sched.h>
+#include <limits.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <linux/reboot.h>
 #include <sys/reboot.h>
 #include <sys/stat.h>
-#include <libevdev/libevdev.h>
-#include <libevdev/libevdev-uinput.h>
+#include <sys/eventfd.h>
+#include <sys/mount.h>
 
 #include "battery_gauge.h"
 #include "arcade_buttons.h"
+#include "battery_fs.h"
+#include "event_loop.h"
+#include "scheduler.h"
+#include "histogram.h"
+#include "config.h"
+#include "keymap.h"
+#include "input_device.h"
+#include "debounce.h"
+#include "pointer.h"
+#include "chord.h"
+#include "turbo.h"
+#include "gesture.h"
+#include "command.h"
+#include "button_poll.h"
+#include "analog_stick.h"
+#include "realtime.h"
+#include "spsc_ring.h"
+#include "input_record.h"
+#include "i2c_bus.h"
 
 // Device file paths
 #define I2C_PATH    "/dev/i2c-1"
@@ -28,65 +54,298 @@
 // I2C addresses
 #define BATTERY_GAUGE_ADDR  0x41
 #define ARCADE_BONNET_ADDR  0x26
+#define ANALOG_STICK_ADDR   0x48
 
 // Other definitions
 #define ARCADE_BONNET_INT_PIN   17
 #define CONTROLLER_NAME         "GGA Controller"
+#define GAMEPAD_NAME            "GGA Gamepad"
+#define MOUSE_NAME              "GGA Mouse"
+// USB ids of a DualShock 4, known to the SDL game controller database
+#define GAMEPAD_VENDOR          0x054c
+#define GAMEPAD_PRODUCT         0x05c4
+#define GAMEPAD_VERSION         0x8111
 #define BATTERY_UPDATE_INTERVAL 200
+#define BATTERY_PUBLISH_INTERVAL 1000
+#define BATTERY_PERSIST_INTERVAL 60000
+#define BUTTON_POLL_FAST        2
+#define BUTTON_POLL_SLOW        10      // No slower than the old fixed polling
+#define BUTTON_POLL_IDLE        1000
+#define STATS_INTERVAL          10000
+#define REPLAY_LEAD             1000    // ms for the devices to be picked up
+#define REPLAY_SPIN             200     // us spun before each replayed entry
+#define REPLAY_TAIL             500     // ms before exiting after the last one
+#define BATTERY_EVENT_RING      16
+#define BUTTON_EVENT_RING       256
+#define BATTERY_STACK_SIZE      (PTHREAD_STACK_MIN + 256 * 1024)
+// Most sources the input loop watches at once: exit and profile signals, the
+// scheduler, the battery wakeup, the chord, gesture, turbo, pointer, stick and
+// replay or poll timers, and a debounce timer and interrupt line per expander
+#define INPUT_LOOP_SOURCES      (10 + 2 * ARCADE_BONNETS_MAX)
+_Static_assert(INPUT_LOOP_SOURCES <= EVENT_LOOP_MAX_SOURCES,
+    "event loop too small for every expander");
+#define INT_WATCHDOG_INTERVAL   200
+#define INT_STUCK_ALERT_COUNT   3
+#define INT_STUCK_ALERT_WINDOW  60000
+#define DEBOUNCE_WINDOW         5
+#define CHORD_WINDOW            30
+#define CHORD_LATENCY_BUDGET    50
+#define POINTER_RATE            250
+#define POINTER_MAX_RATE        1000
+#define POINTER_MIN_SPEED       150
+#define POINTER_MAX_SPEED       1200
+#define POINTER_ACCEL_TIME      500
+#define POINTER_ACCEL_CURVE     2
 #define BATTERY_SAMPLE_BUFFER   128
 #define BATTERY_MIN_VOLTAGE     9.0
 #define BATTERY_CAPACITY_MAH    2500
 #define BATTERY_SHUTDOWN_LIMIT  0.1
+#define BATTERY_STATE_MAX_AGE   300     // s a saved capacity stays usable
+#define BATTERY_STATE_MARGIN    0.2     // Of the capacity, off the estimate
 #define BATTERY_OUTPUT_DIR  "/run/bat"
-
-// Key codes needed
-const static unsigned int KEYCODES[] = {
-    
-    KEY_LEFTCTRL,   // SELECT
-    KEY_S,          // START
-    KEY_ENTER,      // A
-    KEY_TAB,        // Y
-    KEY_ESC,        // B
-    KEY_SPACE,      // X
-
-    KEY_9,          // RB
-    KEY_2,          // RT
-    KEY_1,          // LT
-    KEY_8,          // LB
-
-    KEY_UP,
-    KEY_DOWN,
-    KEY_RIGHT,
-    KEY_LEFT,
-};    
+#define CONFIG_PATH         "/etc/GGA.conf"
+#define BATTERY_STATE_FILE  "/run/GGA.battery"
+#define STATS_OUTPUT_FILE   "/run/GGA.stats"
+#define BATTERY_STATS_FILE  "/run/GGA.battery-stats"
+#define PROFILE_REQUEST_FILE "/run/GGA.profile"
+#define DEFAULT_PROFILE     "default"
 
 // Global variables
 int verbose = 0, batt_charging_last = -1, batt_percentage_last = -1;
+int use_battery_fs = 0;
+battery_status battery = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .full_capacity = BATTERY_CAPACITY_MAH,
+};
+#ifdef BATTERY_FUSE
+battery_fs* battery_files = NULL;
+#endif
 ina219_config* battery_gauge = NULL;
 arcade_bonnet* buttons = NULL;
-struct libevdev *dev = NULL;
-struct libevdev_uinput *uidev = NULL;
+arcade_buttons last_state;
+// Expanders in player order, one interrupt pin is shared by all of them
+unsigned int bonnet_addrs[ARCADE_BONNETS_MAX] = { ARCADE_BONNET_ADDR };
+unsigned int bonnet_count = 1;
+unsigned int int_pins[ARCADE_BONNETS_MAX] = { ARCADE_BONNET_INT_PIN };
+unsigned int int_pin_count = 1;
+int shared_line = 0;            // Expanders after the first use its line
+unsigned long int_check_errors = 0;    // Watchdog checks that failed
+// Players after the first, each with an expander and devices of its own.
+// Hotkeys, turbo and pointer motion stay with player 1
+typedef struct {
+    arcade_bonnet* bonnet;
+    debouncer debounce;
+    arcade_buttons last_state;
+    int debounce_timer;
+    input_device* devices[KEYMAP_LAYOUTS];
+} player;
+player players[ARCADE_BONNETS_MAX - 1];
+int player_count = 0;
+// Profiles are fully built at startup, switching only swaps `profile`
+keymap_profile profiles[KEYMAP_PROFILES];
+int profile_count = 1;
+const keymap_profile* profile = &profiles[0];
+unsigned long profile_switches = 0;
+unsigned int device_layouts = 1 << KEYMAP_KEYBOARD;
+histogram dispatch_time, edge_to_read, edge_to_emit, read_to_emit;
+input_backend backend = INPUT_BACKEND_UINPUT;
+input_device* devices[KEYMAP_LAYOUTS];
+// Devices in use paired with their layout in the active profile, built once
+// at startup
+struct {
+    keymap_layout layout;
+    input_device* device;
+} routes[KEYMAP_LAYOUTS];
+int route_count = 0;
+debouncer debounce;
+debounce_mode debounce_setting = DEBOUNCE_EAGER;
+unsigned int debounce_window = DEBOUNCE_WINDOW;
+int debounce_timer = -1;
+button_poller poller;
+unsigned int poll_fast = BUTTON_POLL_FAST, poll_slow = BUTTON_POLL_SLOW;
+unsigned int poll_idle = BUTTON_POLL_IDLE;
+int poll_timer = -1;
+uint64_t busy_poll_window = 0;  // ns to spin for after activity, 0 is off
+int busy_poll_bus = 0;          // Spin on bonnet reads instead of the INT line
+unsigned long busy_poll_windows = 0;
+histogram spin_edge_to_read, sleep_edge_to_read;
+histogram spin_poll_detection;  // Bus reads have no edge, only the read gap
+int input_cpu = -1;             // CPU the input loop is pinned to
+unsigned int rt_priority = 0;   // SCHED_FIFO priority, 0 is normal scheduling
+unsigned int rt_lock_memory = 0;
+unsigned int rt_watchdog_ms = REALTIME_WATCHDOG_MS;
+unsigned int rt_max_load = REALTIME_MAX_LOAD;
+realtime_watchdog rt_watchdog;
+chord_engine chords;
+unsigned int chord_window = CHORD_WINDOW, chord_budget = CHORD_LATENCY_BUDGET;
+keymap_layout hotkey_layout = KEYMAP_KEYBOARD;   // Chord and gesture keys
+int chord_timer = -1;
+turbo_engine turbo;
+int turbo_timer = -1;
+gesture_engine gestures;
+int gesture_timer = -1;
+command_runner commands;
+pointer_motion pointer;
+unsigned int pointer_rate = POINTER_RATE;
+unsigned int pointer_accel_time = POINTER_ACCEL_TIME;
+double pointer_min_speed = POINTER_MIN_SPEED;
+double pointer_max_speed = POINTER_MAX_SPEED;
+double pointer_accel_curve = POINTER_ACCEL_CURVE;
+int pointer_timer = -1;
+histogram pointer_jitter;
+const char* record_path = NULL;
+const char* replay_path = NULL;
+input_recorder recorder;
+input_replay replay;
+int replay_timer = -1;
+analog_stick stick;
+unsigned int stick_addr = ANALOG_STICK_ADDR;
+int stick_timer = -1;
+uint64_t stick_next = 0;
+event_loop* loop = NULL;
+scheduler* tasks = NULL;
+const char* i2c_trace_path = NULL;
+const char* i2c_replay_path = NULL;
+int i2c_replay_fast = 0;
+uint64_t last_sampled;
+double battery_current_history[BATTERY_SAMPLE_BUFFER];
+double last_capacity;
+// Battery work runs on a thread and loop of its own, so a slow gauge read or
+// file write never holds up input. Samples reach the input loop through
+// `battery_events`, and button activity goes the other way through
+// `button_events`, neither side ever waits on the other. Samples only feed
+// statistics and are dropped when the ring is full, alerts that power off or
+// stop the daemon are sticky flags instead so they cannot be lost
+typedef enum {
+    BATTERY_ALERT_POWER_OFF = 1 << 0,
+    BATTERY_ALERT_FAILED    = 1 << 1,
+} battery_alert;
+typedef struct {
+    double percentage;
+    double current;
+    int charging;
+    uint64_t duration;          // ns the gauge took to sample
+} battery_event;
+typedef struct {
+    arcade_buttons state;
+    uint64_t time;
+} button_event;
+event_loop* battery_loop = NULL;
+scheduler* battery_tasks = NULL;
+pthread_t battery_thread;
+int battery_thread_started = 0;
+int battery_stop_fd = -1;       // Written by the input loop to stop the thread
+int battery_event_fd = -1;      // Written by the battery thread on new events
+spsc_ring battery_events, button_events;
+unsigned int battery_alerts = 0;    // battery_alert bits not yet handled
+int battery_alert_level = 0;        // Percentage when powering off
+// Input loop side
+battery_event battery_last;
+unsigned long battery_samples = 0;
+histogram battery_sample_time;
+int battery_failed = 0;
+// Battery thread side, current drawn with and without buttons in use
+double active_current = 0, idle_current = 0;
+unsigned long active_samples = 0, idle_samples = 0;
+
+// Stops the battery thread and waits for it, safe to call more than once
+void stop_battery_thread()
+{
+    uint64_t one = 1;
+    if (!battery_thread_started)
+    {
+        return;
+    }
+    if (write(battery_stop_fd, &one, sizeof(one)) == sizeof(one))
+    {
+        pthread_join(battery_thread, NULL);
+    }
+    battery_thread_started = 0;
+}
 
 // Exit handler
 void close_resources()
 {
+    stop_battery_thread();
+    #ifdef BATTERY_FUSE
+    if (battery_files) unmount_battery_fs(battery_files);
+    #endif
     if (buttons) close_arcade_bonnet(buttons);
     if (battery_gauge) close_ina219(battery_gauge);
-    if (uidev) libevdev_uinput_destroy(uidev);
-    if (dev) libevdev_free(dev);
+    close_analog_stick(&stick);
+    for (int i = 0; i < KEYMAP_LAYOUTS; i++)
+    {
+        if (devices[i]) close_input_device(devices[i]);
+    }
+    for (int p = 0; p < player_count; p++)
+    {
+        if (players[p].bonnet) close_arcade_bonnet(players[p].bonnet);
+        for (int i = 0; i < KEYMAP_LAYOUTS; i++)
+        {
+            input_device* device = players[p].devices[i];
+            if (device) close_input_device(device);
+        }
+    }
+    stop_realtime_watchdog(&rt_watchdog);
+    close_input_recorder(&recorder);
+    close_input_replay(&replay);
+    close_command_runner(&commands);
+    if (tasks) close_scheduler(tasks);
+    if (loop) close_event_loop(loop);
+    if (battery_tasks) close_scheduler(battery_tasks);
+    if (battery_loop) close_event_loop(battery_loop);
+    if (battery_stop_fd >= 0) close(battery_stop_fd);
+    if (battery_event_fd >= 0) close(battery_event_fd);
+    free_spsc_ring(&battery_events);
+    free_spsc_ring(&button_events);
+    if (close_i2c_trace() != 0)
+    {
+        fprintf(stderr, "Error: I2C trace %s is incomplete!\n",
+            i2c_trace_path);
+    }
 }
-void exit_handler(int signal)
+void exit_handler(event_loop* ev_loop, uint64_t signal, void* data)
 {
-    printf("Exiting GGA...\n");
-    close_resources();
-    exit(0);
+    // Runs from the loop through a signalfd, cleanup happens once it returns
+    stop_event_loop(ev_loop);
+}
+
+// Wakes the input loop to handle battery events, from the battery thread
+void wake_input_loop()
+{
+    uint64_t one = 1;
+    if (write(battery_event_fd, &one, sizeof(one)) != sizeof(one))
+    {
+        fprintf(stderr, "Error: cannot wake the input loop\n");
+    }
+}
+
+// Hands `event` to the input loop, from the battery thread. It is dropped and
+// counted if the input loop is behind
+void post_battery_event(const battery_event* event)
+{
+    if (spsc_ring_push(&battery_events, event) == 0)
+    {
+        wake_input_loop();
+    }
+}
+
+// Raises `alert` on the input loop, from the battery thread. Alerts stay set
+// until handled, however many samples are dropped meanwhile
+void raise_battery_alert(battery_alert alert, double percentage)
+{
+    __atomic_store_n(&battery_alert_level, (int)round(percentage * 100),
+        __ATOMIC_RELAXED);
+    __atomic_fetch_or(&battery_alerts, alert, __ATOMIC_RELEASE);
+    wake_input_loop();
 }
 
-// Battery percentage callback function
+// Battery percentage callback function, runs on the battery thread
 void battery_handler(double percentage, int charging)
 {
     int statusfile, capacityfile, p = (int)round(percentage * 100);
-    if (charging != batt_charging_last)
+    // Files are rendered on read when served by FUSE
+    if (!use_battery_fs && charging != batt_charging_last)
     {
         batt_charging_last = charging;
         statusfile = open(BATTERY_OUTPUT_DIR "/status",
@@ -96,13 +355,15 @@ void battery_handler(double percentage, int charging)
         {
             fprintf(stderr,
                 "Error: cannot create files in " BATTERY_OUTPUT_DIR "\n");
-            close_resources();
-            exit(-1);
+            // Exiting is up to the input loop, which owns the resources
+            raise_battery_alert(BATTERY_ALERT_FAILED, percentage);
+            stop_event_loop(battery_loop);
+            return;
         }
         dprintf(statusfile, "%s\n", charging ? "Charging" : "Discharging");
         close(statusfile);
     }
-    if (p != batt_percentage_last)
+    if (!use_battery_fs && p != batt_percentage_last)
     {
         batt_percentage_last = p;
         capacityfile = open(BATTERY_OUTPUT_DIR "/capacity", 
@@ -112,9 +373,9 @@ void battery_handler(double percentage, int charging)
         {
             fprintf(stderr,
                 "Error: cannot create files in " BATTERY_OUTPUT_DIR "\n");
-            close_resources();
-            if (statusfile > 0) close(statusfile);
-            exit(-1);
+            raise_battery_alert(BATTERY_ALERT_FAILED, percentage);
+            stop_event_loop(battery_loop);
+            return;
         }
         dprintf(capacityfile, "%d\n", p);
         close(capacityfile);
@@ -122,211 +383,1965 @@ void battery_handler(double percentage, int charging)
 
     if (percentage <= BATTERY_SHUTDOWN_LIMIT && !charging)
     {
-        printf("Battery at %d%%, powing down system\n", p);
-        reboot(LINUX_REBOOT_CMD_POWER_OFF);
+        raise_battery_alert(BATTERY_ALERT_POWER_OFF, percentage);
     }
 }
 
-// Buttons callback function
-void check_press_button(arcade_buttons button, arcade_buttons change,
-    arcade_buttons current, unsigned int key)
+// Battery thread events, handled on the input loop
+void battery_event_handler(event_loop* ev_loop, uint64_t value, void* data)
 {
-    if (change & button)
+    battery_event event;
+    uint64_t count;
+    unsigned int alerts;
+    // Clears the wakeup, events posted after this signal it again
+    if (read(battery_event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+        return;
+    }
+    while (spsc_ring_pop(&battery_events, &event))
+    {
+        battery_last = event;
+        battery_samples++;
+        histogram_add(&battery_sample_time, event.duration);
+    }
+
+    alerts = __atomic_exchange_n(&battery_alerts, 0, __ATOMIC_ACQUIRE);
+    if (alerts & BATTERY_ALERT_POWER_OFF)
     {
-        int pressed = (current & button) == 0;
-        if (verbose) printf("Button %d state %d\n", button, pressed);
-        libevdev_uinput_write_event(uidev, EV_KEY, key, pressed);
+        printf("Battery at %d%%, powing down system\n",
+            __atomic_load_n(&battery_alert_level, __ATOMIC_RELAXED));
+        reboot(LINUX_REBOOT_CMD_POWER_OFF);
+    }
+    if (alerts & BATTERY_ALERT_FAILED)
+    {
+        battery_failed = 1;
+        stop_event_loop(ev_loop);
     }
 }
-void button_handler(arcade_buttons last_state, arcade_buttons curr_state,
-    struct libevdev_uinput *uidev)
-{
-    uint16_t changes = last_state ^ curr_state;
-    check_press_button(BUTTON_1A,   changes, curr_state, KEYCODES[0]);
-    check_press_button(BUTTON_1B,   changes, curr_state, KEYCODES[1]);
-    check_press_button(BUTTON_1C,   changes, curr_state, KEYCODES[2]);
-    check_press_button(BUTTON_1D,   changes, curr_state, KEYCODES[3]);
-    check_press_button(BUTTON_1E,   changes, curr_state, KEYCODES[4]);
-    check_press_button(BUTTON_1F,   changes, curr_state, KEYCODES[5]);
-    check_press_button(PAD_DOWN,    changes, curr_state, KEYCODES[6]);
-    check_press_button(PAD_UP,      changes, curr_state, KEYCODES[7]);
-    check_press_button(PAD_RIGHT,   changes, curr_state, KEYCODES[8]);
-    check_press_button(PAD_LEFT,    changes, curr_state, KEYCODES[9]);
-    check_press_button(STICK_RIGHT, changes, curr_state, KEYCODES[10]);
-    check_press_button(STICK_LEFT,  changes, curr_state, KEYCODES[11]); 
-    check_press_button(STICK_DOWN,  changes, curr_state, KEYCODES[12]);
-    check_press_button(STICK_UP,    changes, curr_state, KEYCODES[13]);
-    libevdev_uinput_write_event(uidev, EV_SYN, SYN_REPORT, 0);
-} 
 
-int main(int argc, char** argv)
+// Tells the battery thread about button activity without waiting on it
+void post_button_event(arcade_buttons state, uint64_t time)
 {
-    struct timespec current_ts, last_ts;
-    arcade_buttons last_state;
-    int enable_buttons = 1, enable_battery = 1;
-    double battery_current_history[BATTERY_SAMPLE_BUFFER];
-    double last_capacity;
+    button_event event = { state, time };
+    if (battery_loop) spsc_ring_push(&button_events, &event);
+}
 
-    // Handle flags
-    while (argc > 1)
+// Buttons callback function, sends a frame to each device the change reaches.
+// Frames no read produced pass a `read_time` of 0 and stay out of the timings
+void button_handler(arcade_buttons prev_state, arcade_buttons curr_state,
+    uint64_t edge_time, uint64_t read_time)
+{
+    device_event events[KEYMAP_MAX_EVENTS];
+    uint64_t start = monotonic_ns(), end;
+    for (int r = 0; r < route_count; r++)
     {
-        if (argv[argc - 1][0] == '-')
+        const keymap* map = &profile->maps[routes[r].layout];
+        int count;
+        if (((prev_state ^ curr_state) & map->enabled) == 0)
+        {
+            continue;
+        }
+        count = keymap_events(map, prev_state, curr_state, events);
+        if (count == 0)
         {
-            switch (argv[argc - 1][1])
+            // Only pointer motion changed, the motion timer sends that
+            continue;
+        }
+        if (verbose)
+        {
+            for (int i = 0; i < count; i++)
             {
-                case 'b':
-                    enable_battery = 0;
-                    break;
-                case 's':
-                    enable_buttons = 0;
-                    break;
-                case 'v':
-                    verbose = 1;
-                    break;
-                case 'h':
-                    printf("GGA: hardware handler for GGA console.\n"
-                        "  -h Display this help text\n"
-                        "  -v Increase verbosity\n"
-                        "  -b Don't enable battery monitoring\n"
-                        "  -s Don't enable buttons monitoring\n");
-                    return 0;
+                printf("%s %s %d state %d\n",
+                    keymap_layout_name(routes[r].layout),
+                    events[i].type == EV_ABS ? "axis" : "key",
+                    events[i].code, events[i].value);
             }
         }
-        argc--;
+        emit_input_frame(routes[r].device, events, count, edge_time);
     }
-  
-    if (enable_buttons)
+    if (devices[KEYMAP_MOUSE] && ((prev_state ^ curr_state)
+        & profile->maps[KEYMAP_MOUSE].motion))
+    {
+        const keymap* map = &profile->maps[KEYMAP_MOUSE];
+        arm_event_timer(loop, pointer_timer, set_pointer_direction(&pointer,
+            keymap_rel_direction(map, curr_state, REL_X),
+            keymap_rel_direction(map, curr_state, REL_Y), start));
+    }
+    end = monotonic_ns();
+
+    post_button_event(curr_state, read_time ? read_time : start);
+    if (!read_time)
+    {
+        return;
+    }
+    histogram_add(&dispatch_time, end - start);
+    histogram_add(&read_to_emit, end - read_time);
+    if (edge_time)
+    {
+        histogram_add(&edge_to_read, read_time - edge_time);
+        histogram_add(&edge_to_emit, end - edge_time);
+    }
+}
+
+// Sends the changes of a player after the first straight to its devices
+void player_button_handler(player* p, arcade_buttons curr_state,
+    uint64_t edge_time)
+{
+    device_event events[KEYMAP_MAX_EVENTS];
+    for (int i = 0; i < KEYMAP_LAYOUTS; i++)
     {
-        // Set up keyboard input device
-        dev = libevdev_new();
-        libevdev_set_name(dev, CONTROLLER_NAME);
-        libevdev_enable_event_type(dev, EV_KEY);
-        for (int i = 0; i < ARCADE_BUTTONS_COUNT; i++)
+        const keymap* map = &profile->maps[i];
+        int count;
+        if (!p->devices[i]
+            || ((p->last_state ^ curr_state) & map->enabled) == 0)
         {
-            libevdev_enable_event_code(dev, EV_KEY, KEYCODES[i], NULL);
+            continue;
         }
-        if (libevdev_uinput_create_from_device(
-            dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uidev) != 0)
+        count = keymap_events(map, p->last_state, curr_state, events);
+        if (count)
         {
-            fprintf(stderr, "Error: cannot create keyboard device!\n");
-            close_resources();
+            emit_input_frame(p->devices[i], events, count, edge_time);
+        }
+    }
+    p->last_state = curr_state;
+    post_button_event(curr_state, edge_time);
+}
+
+// Makes `next` the active profile between two frames. Outputs of buttons
+// held across the switch are released as the old profile maps them, then
+// pressed again as the new one does
+void switch_profile(const keymap_profile* next)
+{
+    const arcade_buttons released = (arcade_buttons)0xffff;
+    if (next == profile)
+    {
+        return;
+    }
+    arcade_buttons held[ARCADE_BONNETS_MAX - 1];
+    // Made up frames, nothing was read to time them against
+    button_handler(last_state, released, 0, 0);
+    for (int p = 0; p < player_count; p++)
+    {
+        held[p] = players[p].last_state;
+        player_button_handler(&players[p], released, 0);
+    }
+    profile = next;
+    button_handler(released, last_state, 0, 0);
+    for (int p = 0; p < player_count; p++)
+    {
+        player_button_handler(&players[p], held[p], 0);
+    }
+    profile_switches++;
+    if (verbose) printf("Switched to profile %s\n", profile->name);
+}
+
+// Returns the profile called `name`, or NULL if there is none
+keymap_profile* find_profile(const char* name)
+{
+    for (int p = 0; p < profile_count; p++)
+    {
+        if (strcmp(profiles[p].name, name) == 0)
+        {
+            return &profiles[p];
+        }
+    }
+    return NULL;
+}
+
+// Creates the device of player `number` (from 1) for `layout` with every
+// output of its keymaps
+input_device* create_device(keymap_layout layout,
+    input_backend device_backend, int number)
+{
+    const char* names[KEYMAP_LAYOUTS] = {
+        CONTROLLER_NAME, GAMEPAD_NAME, MOUSE_NAME,
+    };
+    char name[UINPUT_MAX_NAME_SIZE];
+    input_device* device;
+    if (number > 1)
+    {
+        snprintf(name, sizeof(name), "%s %d", names[layout], number);
+    }
+    else
+    {
+        snprintf(name, sizeof(name), "%s", names[layout]);
+    }
+    device = new_input_device(name, device_backend);
+    if (!device)
+    {
+        return NULL;
+    }
+    if (layout == KEYMAP_GAMEPAD)
+    {
+        set_device_id(device, BUS_USB, GAMEPAD_VENDOR, GAMEPAD_PRODUCT,
+            GAMEPAD_VERSION);
+    }
+    if (number == 1 && layout == hotkey_layout
+        && (enable_chord_outputs(&chords, device) != 0
+            || enable_gesture_outputs(&gestures, device) != 0))
+    {
+        close_input_device(device);
+        return NULL;
+    }
+    // Outputs cannot change once the device exists, so it gets those of
+    // every profile up front
+    for (int p = 0; p < profile_count; p++)
+    {
+        if (enable_keymap_outputs(&profiles[p].maps[layout], device) != 0)
+        {
+            close_input_device(device);
+            return NULL;
+        }
+    }
+    if (start_input_device(device) != 0)
+    {
+        close_input_device(device);
+        return NULL;
+    }
+    return device;
+}
+
+// Creates the devices of player `number` for the layouts in `layouts`,
+// falling back to libevdev. Returns zero on success, and a negative value on
+// errors
+int create_player_devices(input_device** created, int number,
+    unsigned int layouts)
+{
+    for (int i = 0; i < KEYMAP_LAYOUTS; i++)
+    {
+        if (!(layouts & (1 << i)))
+        {
+            continue;
+        }
+        created[i] = create_device(i, backend, number);
+        if (!created[i] && backend != INPUT_BACKEND_LIBEVDEV)
+        {
+            fprintf(stderr, "Warning: falling back to libevdev for input\n");
+            created[i] = create_device(i, INPUT_BACKEND_LIBEVDEV, number);
+        }
+        if (!created[i])
+        {
+            fprintf(stderr, "Error: cannot create %s device!\n",
+                keymap_layout_name(i));
             return -1;
         }
-        // Initialize arcade bonnet
-        buttons = configure_arcade_bonnet(ARCADE_BONNET_ADDR, I2C_PATH);
-        if (!buttons)
+    }
+    return 0;
+}
+
+// Parses whitespace separated numbers in `value` into `out`, which holds
+// ARCADE_BONNETS_MAX. Returns how many there are, or a negative value on errors
+int parse_bonnet_list(const char* value, unsigned int* out)
+{
+    char buf[CONFIG_LINE_LEN], *tokens[ARCADE_BONNETS_MAX];
+    int count;
+    strncpy(buf, value, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    count = split_config_value(buf, tokens, ARCADE_BONNETS_MAX);
+    for (int i = 0; i < count; i++)
+    {
+        if (parse_config_uint(tokens[i], &out[i]) != 0)
         {
-            fprintf(stderr, "Error: cannot setup arcade bonnet IC!\n");
-            close_resources();
             return -1;
         }
-        last_state = buttons->state;
-        #ifdef GPIO_INT
-        // Setup GPIO interrupt
-        configure_button_interrupt(GPIO_PATH, ARCADE_BONNET_INT_PIN, buttons);
-        #endif
     }
+    return count > 0 ? count : -1;
+}
 
-    if (enable_battery)
+// Configuration file callback function
+int config_entry_handler(
+    const char* section, const char* key, const char* value, void* data)
+{
+    // Keymap sections followed by a name ([gamepad mame]) set up a profile
+    for (int i = 0; i < KEYMAP_LAYOUTS; i++)
     {
-        // Setup battery logging files directory
-        if (mkdir(BATTERY_OUTPUT_DIR,
-            S_ISVTX | S_IRWXU | S_IWGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0)
+        const char* layout = i == KEYMAP_KEYBOARD ? "keymap"
+            : keymap_layout_name(i);
+        size_t length = strlen(layout);
+        keymap_profile* target = &profiles[0];
+        if (strncmp(section, layout, length) != 0
+            || (section[length] != '\0' && section[length] != ' '))
         {
-            if (errno != EEXIST)
+            continue;
+        }
+        if (section[length] != '\0')
+        {
+            const char* name = section + length + strspn(section + length, " ");
+            target = find_profile(name);
+            if (!target && profile_count < KEYMAP_PROFILES
+                && default_keymap_profile(&profiles[profile_count], name) == 0)
+            {
+                target = &profiles[profile_count++];
+            }
+            if (!target)
             {
-                fprintf(stderr, "Error: cannot create "BATTERY_OUTPUT_DIR"\n");
-                close_resources();
                 return -1;
             }
-            else if (chmod(BATTERY_OUTPUT_DIR,
-                S_ISVTX | S_IRWXU | S_IWGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0)
+        }
+        target->configured |= 1 << i;
+        return configure_keymap(&target->maps[i], key, value);
+    }
+    if (strcmp(section, "input") == 0
+        && (strcmp(key, "devices") == 0 || strcmp(key, "mode") == 0))
+    {
+        char buf[CONFIG_LINE_LEN], *names[KEYMAP_LAYOUTS];
+        int count;
+        // Older files picked the one device with mode, which devices replaced
+        if (key[0] == 'm')
+        {
+            fprintf(stderr, "Warning: [input] mode is deprecated, "
+                "use devices = %s instead\n", value);
+        }
+        strncpy(buf, value, sizeof(buf) - 1);
+        buf[sizeof(buf) - 1] = '\0';
+        count = split_config_value(buf, names, KEYMAP_LAYOUTS);
+        if (count <= 0)
+        {
+            return -1;
+        }
+        device_layouts = 0;
+        for (int n = 0; n < count; n++)
+        {
+            int i;
+            for (i = 0; i < KEYMAP_LAYOUTS; i++)
+            {
+                if (strcmp(names[n], keymap_layout_name(i)) == 0) break;
+            }
+            if (i == KEYMAP_LAYOUTS)
             {
-                fprintf(stderr, "Error: already exits "BATTERY_OUTPUT_DIR"\n");
-                close_resources();
                 return -1;
             }
+            device_layouts |= 1 << i;
         }
-        // Initialize battery gauge
-        battery_gauge = initialize_ina219(
-            BATTERY_GAUGE_ADDR, I2C_PATH, BUS_VOLTAGE_RANGE_16V_5A);
-        if (!battery_gauge)
+        return 0;
+    }
+    else if (strcmp(section, "input") == 0 && strcmp(key, "expanders") == 0)
+    {
+        int count = parse_bonnet_list(value, bonnet_addrs);
+        if (count < 0)
         {
-            fprintf(stderr, "Error: cannot setup battery gauge IC!\n");
-            close_resources();
             return -1;
         }
-        // Set up battery monitoring
-        memset(battery_current_history, 0,
-            BATTERY_SAMPLE_BUFFER * sizeof(double));
-        last_capacity = estimate_battery_percentage(
-            BATTERY_MIN_VOLTAGE, battery_gauge) * BATTERY_CAPACITY_MAH;
-        clock_gettime(CLOCK_REALTIME, &last_ts);
+        bonnet_count = count;
+        return 0;
     }
-
-    // Set up interrupt handlers
-    signal(SIGTERM, exit_handler);
-    signal(SIGINT, exit_handler);
-    signal(SIGQUIT, exit_handler);
-
-    printf("Started GGA\n");
-
-    for (;;)
+    else if (strcmp(section, "input") == 0
+        && strcmp(key, "interrupt_pins") == 0)
     {
-        unsigned int ms_passed = 0;
-        if (enable_buttons)
+        int count = parse_bonnet_list(value, int_pins);
+        if (count < 0)
         {
-            #ifdef GPIO_INT
-            int button_update = wait_for_button_interrupt(
-                buttons, BATTERY_UPDATE_INTERVAL);
-            #else
-            usleep(10000); // 10ms
-            int button_update = read_buttons_pressed(buttons);
-            #endif
-
-            if (button_update)
-            {
-                button_handler(last_state, buttons->state, uidev);
-                last_state = buttons->state;
-            }
+            return -1;
         }
-        if (enable_battery)
+        int_pin_count = count;
+        return 0;
+    }
+    else if (strcmp(section, "input") == 0 && strcmp(key, "backend") == 0)
+    {
+        if (strcmp(value, "uinput") == 0)
         {
-            clock_gettime(CLOCK_REALTIME, &current_ts);
-            ms_passed = ((current_ts.tv_sec - last_ts.tv_sec) * 1000)
-                + ((current_ts.tv_nsec - last_ts.tv_nsec) / 1000000);
-            if (ms_passed >= BATTERY_UPDATE_INTERVAL)
-            {
-                double shunt_voltage = get_shunt_voltage(battery_gauge);
-                double current = get_current(battery_gauge);
-                double new_capacity = last_capacity + 
-                    (current * ((double)ms_passed / 3.6e6));
-                int charging = 0;
-                
-                battery_current_history[0] = current;
-                for (int i = BATTERY_SAMPLE_BUFFER - 1; i > 0; i--)
-                {
-                    battery_current_history[i] = battery_current_history[i - 1];
-                    if (battery_current_history[i] > 0)
-                    {
-                        charging = 1;
-                    }
-                }
-                last_capacity = new_capacity;
-                last_ts = current_ts;
-                battery_handler(new_capacity / BATTERY_CAPACITY_MAH, charging);
-                
-                if (verbose)
-                {
-                    printf("Battery: %lf%% (%s), %lf V, %lf mA, %lf mAh\n",
-                        100 * (new_capacity / BATTERY_CAPACITY_MAH),
-                        charging ? "Charging" : "Discharging",
-                        get_bus_voltage(battery_gauge),
-                        current, new_capacity);
-                }
-            }
+            backend = INPUT_BACKEND_UINPUT;
+        }
+        else if (strcmp(value, "libevdev") == 0)
+        {
+            backend = INPUT_BACKEND_LIBEVDEV;
+        }
+        else
+        {
+            return -1;
         }
+        return 0;
     }
-    close_resources();
-    return 0;
+    else if (strcmp(section, "debounce") == 0 && strcmp(key, "mode") == 0)
+    {
+        if (strcmp(value, "off") == 0)
+        {
+            debounce_setting = DEBOUNCE_OFF;
+        }
+        else if (strcmp(value, "eager") == 0)
+        {
+            debounce_setting = DEBOUNCE_EAGER;
+        }
+        else if (strcmp(value, "verify") == 0)
+        {
+            debounce_setting = DEBOUNCE_VERIFY;
+        }
+        else
+        {
+            return -1;
+        }
+        return 0;
+    }
+    else if (strcmp(section, "debounce") == 0 && strcmp(key, "window_ms") == 0)
+    {
+        return parse_config_uint(value, &debounce_window);
+    }
+    else if (strcmp(section, "chords") == 0 && strcmp(key, "window_ms") == 0)
+    {
+        return parse_config_uint(value, &chord_window);
+    }
+    else if (strcmp(section, "chords") == 0 && strcmp(key, "budget_ms") == 0)
+    {
+        return parse_config_uint(value, &chord_budget);
+    }
+    else if (strcmp(section, "chords") == 0 && strcmp(key, "shift") == 0)
+    {
+        return set_chord_shifts(&chords, value);
+    }
+    else if (strcmp(section, "chords") == 0)
+    {
+        return add_chord(&chords, key, value);
+    }
+    else if (strcmp(section, "commands") == 0
+        && strcmp(key, "interval_ms") == 0)
+    {
+        unsigned int interval;
+        if (parse_config_uint(value, &interval) != 0)
+        {
+            return -1;
+        }
+        commands.interval = interval * 1000000ULL;
+        return 0;
+    }
+    else if (strcmp(section, "commands") == 0)
+    {
+        // Chords are joined with '+', gestures named BUTTON.kind
+        int command = add_command(&commands, value);
+        if (command < 0)
+        {
+            return -1;
+        }
+        return strchr(key, '+') ? add_chord_command(&chords, key, command)
+            : add_gesture_command(&gestures, key, command);
+    }
+    else if (strcmp(section, "gestures") == 0)
+    {
+        return configure_gesture(&gestures, key, value);
+    }
+    else if (strcmp(section, "turbo") == 0)
+    {
+        return configure_turbo(&turbo, key, value);
+    }
+    else if (strcmp(section, "polling") == 0 && strcmp(key, "fast_ms") == 0)
+    {
+        if (parse_config_uint(value, &poll_fast) != 0 || poll_fast == 0)
+        {
+            return -1;
+        }
+        return 0;
+    }
+    else if (strcmp(section, "polling") == 0 && strcmp(key, "slow_ms") == 0)
+    {
+        return parse_config_uint(value, &poll_slow);
+    }
+    else if (strcmp(section, "polling") == 0 && strcmp(key, "idle_ms") == 0)
+    {
+        return parse_config_uint(value, &poll_idle);
+    }
+    else if (strcmp(section, "busy_poll") == 0
+        && strcmp(key, "window_ms") == 0)
+    {
+        unsigned int window;
+        if (parse_config_uint(value, &window) != 0)
+        {
+            return -1;
+        }
+        busy_poll_window = window * 1000000ULL;
+        return 0;
+    }
+    else if (strcmp(section, "busy_poll") == 0 && strcmp(key, "source") == 0)
+    {
+        if (strcmp(value, "line") == 0)
+        {
+            busy_poll_bus = 0;
+        }
+        else if (strcmp(value, "bus") == 0)
+        {
+            busy_poll_bus = 1;
+        }
+        else
+        {
+            return -1;
+        }
+        return 0;
+    }
+    else if ((strcmp(section, "busy_poll") == 0
+        || strcmp(section, "realtime") == 0) && strcmp(key, "cpu") == 0)
+    {
+        unsigned int cpu;
+        if (parse_config_uint(value, &cpu) != 0 || cpu >= CPU_SETSIZE)
+        {
+            return -1;
+        }
+        input_cpu = cpu;
+        return 0;
+    }
+    else if (strcmp(section, "realtime") == 0 && strcmp(key, "priority") == 0)
+    {
+        if (parse_config_uint(value, &rt_priority) != 0
+            || rt_priority > REALTIME_MAX_PRIORITY)
+        {
+            return -1;
+        }
+        return 0;
+    }
+    else if (strcmp(section, "realtime") == 0
+        && strcmp(key, "lock_memory") == 0)
+    {
+        if (parse_config_uint(value, &rt_lock_memory) != 0
+            || rt_lock_memory > 1)
+        {
+            return -1;
+        }
+        return 0;
+    }
+    else if (strcmp(section, "realtime") == 0
+        && strcmp(key, "watchdog_ms") == 0)
+    {
+        if (parse_config_uint(value, &rt_watchdog_ms) != 0
+            || rt_watchdog_ms == 0)
+        {
+            return -1;
+        }
+        return 0;
+    }
+    else if (strcmp(section, "realtime") == 0 && strcmp(key, "max_load") == 0)
+    {
+        if (parse_config_uint(value, &rt_max_load) != 0 || rt_max_load == 0
+            || rt_max_load > 100)
+        {
+            return -1;
+        }
+        return 0;
+    }
+    else if (strcmp(section, "pointer") == 0 && strcmp(key, "rate_hz") == 0)
+    {
+        if (parse_config_uint(value, &pointer_rate) != 0 || pointer_rate == 0
+            || pointer_rate > POINTER_MAX_RATE)
+        {
+            return -1;
+        }
+        return 0;
+    }
+    else if (strcmp(section, "pointer") == 0 && strcmp(key, "min_speed") == 0)
+    {
+        return parse_config_double(value, &pointer_min_speed);
+    }
+    else if (strcmp(section, "pointer") == 0 && strcmp(key, "max_speed") == 0)
+    {
+        return parse_config_double(value, &pointer_max_speed);
+    }
+    else if (strcmp(section, "pointer") == 0 && strcmp(key, "accel_ms") == 0)
+    {
+        return parse_config_uint(value, &pointer_accel_time);
+    }
+    else if (strcmp(section, "pointer") == 0 && strcmp(key, "curve") == 0)
+    {
+        return parse_config_double(value, &pointer_accel_curve);
+    }
+    else if (strcmp(section, "analog") == 0 && strcmp(key, "address") == 0)
+    {
+        return parse_config_uint(value, &stick_addr);
+    }
+    else if (strcmp(section, "analog") == 0)
+    {
+        return configure_analog_stick(&stick, key, value);
+    }
+    return -1;
+}
+
+// Seconds since boot, counting suspend, which drains the battery too
+double boottime_s(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Battery capacity persistence across daemon restarts, /run clears on boot.
+// Nothing was integrated while the daemon was stopped, so a capacity saved
+// longer ago than that is dropped, as are files without the time
+double load_battery_capacity(void)
+{
+    double capacity, saved;
+    FILE* state = fopen(BATTERY_STATE_FILE, "r");
+    if (!state)
+    {
+        return -1;
+    }
+    if (fscanf(state, "%lf %lf", &capacity, &saved) != 2
+        || boottime_s() - saved > BATTERY_STATE_MAX_AGE)
+    {
+        capacity = -1;
+    }
+    fclose(state);
+    return capacity;
+}
+void save_battery_capacity(double capacity)
+{
+    FILE* state = fopen(BATTERY_STATE_FILE ".tmp", "w");
+    if (!state)
+    {
+        return;
+    }
+    fprintf(state, "%lf %.3f\n", capacity, boottime_s());
+    if (fclose(state) == 0)
+    {
+        rename(BATTERY_STATE_FILE ".tmp", BATTERY_STATE_FILE);
+    }
+}
+
+// Sends gesture keys, and the states left after gestures through turbo to
+// the keymap
+void gesture_handler(const gesture_result* result, uint64_t time,
+    uint64_t edge_time, uint64_t read_time)
+{
+    for (int i = 0; i < result->state_count; i++)
+    {
+        arcade_buttons next = turbo_update(&turbo, result->states[i], time);
+        if (next != last_state)
+        {
+            button_handler(last_state, next, edge_time, read_time);
+            last_state = next;
+        }
+    }
+    for (int i = 0; i < result->command_count; i++)
+    {
+        run_command(&commands, result->commands[i], time);
+    }
+    if (result->event_count)
+    {
+        if (verbose) printf("Gesture keys: %d\n", result->event_count);
+        emit_input_frame(devices[hotkey_layout], result->events,
+            result->event_count, edge_time);
+    }
+    if (turbo.buttons)
+    {
+        arm_event_timer(loop, turbo_timer, turbo_deadline(&turbo));
+    }
+    if (gestures.gestures | gestures.repeats)
+    {
+        arm_event_timer(loop, gesture_timer, gesture_deadline(&gestures));
+    }
+}
+
+// Resolves chords in a debounced state and emits what reaches the keymap
+void chord_handler(arcade_buttons state, uint64_t time, uint64_t edge_time,
+    uint64_t read_time)
+{
+    device_event events[KEYMAP_MAX_EVENTS];
+    gesture_result gesture;
+    chord_result result;
+    chord_update(&chords, state, time, &result);
+    for (int i = 0; i < result.state_count; i++)
+    {
+        gesture_update(&gestures, result.states[i], time, &gesture);
+        gesture_handler(&gesture, time, edge_time, read_time);
+    }
+    if (result.pressed | result.released)
+    {
+        int count = chord_events(&chords, result.pressed, result.released,
+            events);
+        if (verbose)
+        {
+            printf("Chords +%x -%x\n", result.pressed, result.released);
+        }
+        if (count)
+        {
+            emit_input_frame(devices[hotkey_layout], events, count, edge_time);
+        }
+        // Commands only queue a request, spawning happens on the worker
+        for (uint16_t bits = result.pressed; bits; bits &= bits - 1)
+        {
+            int command = chords.chords[__builtin_ctz(bits)].command;
+            if (command >= 0) run_command(&commands, command, time);
+        }
+    }
+    if (chords.count)
+    {
+        arm_event_timer(loop, chord_timer, chord_deadline(&chords));
+    }
+}
+
+// Debounces a raw state and emits the result if it changed
+void debounce_handler(arcade_buttons raw, uint64_t time, uint64_t edge_time,
+    uint64_t read_time)
+{
+    arcade_buttons state;
+    record_input(&recorder, 0, raw, time);
+    state = debounce_buttons(&debounce, raw, time);
+    chord_handler(state, time, edge_time, read_time);
+    arm_event_timer(loop, debounce_timer, debounce_deadline(&debounce));
+}
+
+void busy_poll_handler(event_loop* loop, uint64_t now, void* data);
+
+// Emits the states the buttons went through during the last read
+void process_button_update(int button_update)
+{
+    if (button_update > 0 && buttons->edge_time)
+    {
+        // Reads within a window are compared against reads woken from sleep,
+        // which are collected with busy polling off too as the baseline
+        histogram_add(loop->spin_until > buttons->read_time
+            ? &spin_edge_to_read : &sleep_edge_to_read,
+            buttons->read_time - buttons->edge_time);
+    }
+    if (button_update > 0 && busy_poll_window)
+    {
+        uint64_t now = monotonic_ns();
+        if (loop->spin_until <= now) busy_poll_windows++;
+        spin_event_loop(loop, now + busy_poll_window, busy_poll_handler, NULL);
+    }
+    if (button_update > 0)
+    {
+        // Replay a captured tap as its own frame before the current state
+        arcade_buttons states[2];
+        uint64_t edge_time = buttons->edge_time;
+        int count = button_state_sequence(buttons, debounce.raw, states);
+        for (int i = 0; i < count; i++)
+        {
+            debounce_handler(states[i], edge_time ? edge_time
+                : buttons->read_time, edge_time, buttons->read_time);
+            edge_time = 0;
+        }
+    }
+}
+
+// Debounces the states a player after the first went through
+void player_debounce_handler(player* p, arcade_buttons raw, uint64_t time,
+    uint64_t edge_time)
+{
+    record_input(&recorder, p - players + 1, raw, time);
+    player_button_handler(p, debounce_buttons(&p->debounce, raw, time),
+        edge_time);
+    arm_event_timer(loop, p->debounce_timer, debounce_deadline(&p->debounce));
+}
+void process_player_update(player* p, int button_update)
+{
+    if (button_update > 0)
+    {
+        arcade_buttons states[2];
+        uint64_t edge_time = p->bonnet->edge_time;
+        int count = button_state_sequence(p->bonnet, p->debounce.raw, states);
+        for (int i = 0; i < count; i++)
+        {
+            player_debounce_handler(p, states[i],
+                edge_time ? edge_time : p->bonnet->read_time, edge_time);
+            edge_time = 0;
+        }
+    }
+}
+
+#ifdef GPIO_INT
+// Reads the expanders behind player 1's interrupt line, only those that
+// latched an interrupt when the line is shared. `sampled` stands in for the
+// edge time if the kernel has not queued the edge yet
+void read_line_expanders(uint64_t sampled)
+{
+    uint64_t edge_time;
+    if (consume_button_interrupt(buttons) != 0)
+    {
+        return;
+    }
+    edge_time = buttons->edge_time ? buttons->edge_time : sampled;
+    buttons->edge_time = edge_time;
+    process_button_update(shared_line ? read_buttons_flagged(buttons)
+        : read_buttons_pressed(buttons));
+    for (int p = 0; p < player_count; p++)
+    {
+        if (!players[p].bonnet->int_pin)
+        {
+            players[p].bonnet->edge_time = edge_time;
+            process_player_update(&players[p],
+                read_buttons_flagged(players[p].bonnet));
+        }
+    }
+}
+#endif
+
+// Event loop callbacks
+void busy_poll_handler(event_loop* ev_loop, uint64_t now, void* data)
+{
+    uint64_t previous = buttons->read_time;
+    int ret;
+    #ifdef GPIO_INT
+    if (!busy_poll_bus && buttons->int_pin)
+    {
+        // Only touch the bus once an expander asserts the interrupt
+        if (button_interrupt_asserted(buttons) == 1) read_line_expanders(now);
+        return;
+    }
+    #endif
+    // There is no edge, the change happened at some point after the previous
+    // read, so the gap between reads bounds how long it took to see it
+    ret = read_buttons_pressed(buttons);
+    buttons->edge_time = 0;
+    if (ret > 0)
+    {
+        histogram_add(&spin_poll_detection, buttons->read_time - previous);
+    }
+    process_button_update(ret);
+}
+void profile_handler(event_loop* ev_loop, uint64_t signal, void* data)
+{
+    // The profile to switch to is named in a file, none is the default
+    char name[KEYMAP_PROFILE_NAME + 1] = DEFAULT_PROFILE;
+    const keymap_profile* next;
+    FILE* request = fopen(PROFILE_REQUEST_FILE, "r");
+    if (request)
+    {
+        if (!fgets(name, sizeof(name), request) || name[0] == '\n')
+        {
+            strcpy(name, DEFAULT_PROFILE);
+        }
+        name[strcspn(name, "\n")] = '\0';
+        fclose(request);
+    }
+    next = find_profile(name);
+    if (!next)
+    {
+        fprintf(stderr, "Warning: unknown profile %s\n", name);
+        return;
+    }
+    switch_profile(next);
+}
+void debounce_timer_handler(event_loop* ev_loop, uint64_t now, void* data)
+{
+    // A held back edge is due, nothing was read so there is no edge time
+    debounce_handler(debounce.raw, now, 0, now);
+}
+void chord_timer_handler(event_loop* ev_loop, uint64_t now, void* data)
+{
+    // The decision window ran out, held back presses go to the keymap
+    chord_handler(debounce.state, now, 0, now);
+}
+void gesture_timer_handler(event_loop* ev_loop, uint64_t now, void* data)
+{
+    gesture_result result;
+    gesture_expire(&gestures, now, &result);
+    gesture_handler(&result, now, 0, now);
+}
+void turbo_timer_handler(event_loop* ev_loop, uint64_t now, void* data)
+{
+    // Toggles due together go out as one frame
+    arcade_buttons state = turbo_expire(&turbo, now);
+    if (state != last_state)
+    {
+        button_handler(last_state, state, 0, now);
+        last_state = state;
+    }
+    arm_event_timer(ev_loop, turbo_timer, turbo_deadline(&turbo));
+}
+void replay_timer_handler(event_loop* ev_loop, uint64_t now, void* data)
+{
+    if (!replay.due)
+    {
+        // Held back and repeating outputs had their time, the replay is over
+        stop_event_loop(ev_loop);
+        return;
+    }
+    // The timer fires REPLAY_SPIN early, the rest is spun as a timer wakeup
+    // alone misses by more than the recording's resolution
+    while (replay.due && replay.due <= now + REPLAY_SPIN * 1000ULL)
+    {
+        uint64_t due = replay.due;
+        while ((now = monotonic_ns()) < due);
+        histogram_add(&replay.start_error, now - due);
+        // Fed in as a fresh read, so the latency stats cover the pipeline
+        if (replay.player == 0)
+        {
+            debounce_handler(replay.state, now, now, now);
+        }
+        else if (replay.player <= player_count)
+        {
+            player_debounce_handler(&players[replay.player - 1],
+                replay.state, now, now);
+        }
+        histogram_add(&replay.emit_error, monotonic_ns() - due);
+        replay.replayed++;
+        if (advance_input_replay(&replay) < 0)
+        {
+            fprintf(stderr, "Error: %s is cut short\n", replay_path);
+        }
+    }
+    arm_event_timer(ev_loop, replay_timer, replay.due
+        ? replay.due - REPLAY_SPIN * 1000ULL
+        : now + REPLAY_TAIL * 1000000ULL);
+}
+void pointer_timer_handler(event_loop* ev_loop, uint64_t now, void* data)
+{
+    device_event events[2];
+    uint64_t due = pointer.next_report, next;
+    int dx, dy, count = 0;
+    if (!due)
+    {
+        return;
+    }
+    histogram_add(&pointer_jitter, now - due);
+    next = pointer_motion_step(&pointer, now, &dx, &dy);
+    if (dx)
+    {
+        events[count++] = (device_event){ EV_REL, REL_X, dx };
+    }
+    if (dy)
+    {
+        events[count++] = (device_event){ EV_REL, REL_Y, dy };
+    }
+    if (count)
+    {
+        emit_input_frame(devices[KEYMAP_MOUSE], events, count, 0);
+    }
+    arm_event_timer(ev_loop, pointer_timer, next);
+}
+void stick_timer_handler(event_loop* ev_loop, uint64_t now, void* data)
+{
+    device_event event;
+    // Conversions run between two ticks, so a late tick only delays a report
+    if (analog_stick_step(&stick, &event) > 0)
+    {
+        emit_input_frame(devices[KEYMAP_GAMEPAD], &event, 1, 0);
+    }
+    stick_next += analog_stick_period(&stick);
+    if (stick_next <= now) stick_next = now + analog_stick_period(&stick);
+    arm_event_timer(ev_loop, stick_timer, stick_next);
+}
+void button_poll_handler(event_loop* ev_loop, uint64_t now, void* data)
+{
+    int ret = read_buttons_pressed(buttons), changed = ret > 0;
+    arcade_buttons held = buttons->state;
+    // Polled reads have no edge, drop any left by an earlier interrupt
+    buttons->edge_time = 0;
+    process_button_update(ret);
+    for (int p = 0; p < player_count; p++)
+    {
+        ret = read_buttons_pressed(players[p].bonnet);
+        players[p].bonnet->edge_time = 0;
+        changed |= ret > 0;
+        // Pulled up inputs, a button held on any expander clears its bit
+        held &= players[p].bonnet->state;
+        process_player_update(&players[p], ret);
+    }
+    arm_event_timer(ev_loop, poll_timer,
+        button_poll_step(&poller, held, changed, now));
+}
+void button_update_handler(event_loop* ev_loop, uint64_t value, void* data)
+{
+    #ifdef GPIO_INT
+    if (buttons->int_pin && shared_line)
+    {
+        read_line_expanders(0);
+        return;
+    }
+    else if (buttons->int_pin)
+    {
+        process_button_update(read_button_interrupt(buttons));
+        return;
+    }
+    #endif
+    process_button_update(read_buttons_pressed(buttons));
+}
+void player_debounce_timer_handler(event_loop* ev_loop, uint64_t now,
+    void* data)
+{
+    player* p = data;
+    player_debounce_handler(p, p->debounce.raw, now, 0);
+}
+#ifdef GPIO_INT
+void player_interrupt_handler(event_loop* ev_loop, uint64_t value, void* data)
+{
+    player* p = data;
+    process_player_update(p, read_button_interrupt(p->bonnet));
+}
+#endif
+
+// Periodic tasks
+#ifdef GPIO_INT
+// Recoveries summed over every expander with an interrupt line
+unsigned long interrupt_recoveries()
+{
+    unsigned long recoveries = buttons->recoveries;
+    for (int p = 0; p < player_count; p++)
+    {
+        if (players[p].bonnet->int_pin)
+        {
+            recoveries += players[p].bonnet->recoveries;
+        }
+    }
+    return recoveries;
+}
+// Checks one expander's line, returns `recover_button_interrupt`'s result
+int check_button_interrupt(arcade_bonnet* bonnet)
+{
+    int ret = recover_button_interrupt(bonnet);
+    if (ret < 0)
+    {
+        // A failed check is no recovery, the next one tries again
+        int_check_errors++;
+        if (verbose)
+        {
+            printf("Cannot %s expander 0x%02x\n", ret == -1
+                ? "read the interrupt line of" : "clear the interrupt of",
+                bonnet->addr);
+        }
+    }
+    return ret;
+}
+void int_watchdog_task(periodic_task* task, uint64_t now, void* data)
+{
+    static unsigned long seen = 0, window_base = 0;
+    static uint64_t window_start = 0;
+    static int alerted = 0;
+    unsigned long recoveries;
+    int ret = check_button_interrupt(buttons);
+    process_button_update(ret);
+    for (int p = 0; p < player_count; p++)
+    {
+        arcade_bonnet* bonnet = players[p].bonnet;
+        if (bonnet->int_pin)
+        {
+            process_player_update(&players[p],
+                check_button_interrupt(bonnet));
+        }
+        else if (ret != 0)
+        {
+            // Another expander may be what holds the shared line down
+            bonnet->edge_time = 0;
+            process_player_update(&players[p], read_buttons_pressed(bonnet));
+        }
+    }
+
+    recoveries = interrupt_recoveries();
+    if (recoveries == seen)
+    {
+        return;
+    }
+    if (verbose) printf("Recovered stuck button interrupt\n");
+    if (now - window_start > INT_STUCK_ALERT_WINDOW * 1000000ULL)
+    {
+        window_start = now;
+        window_base = seen;
+        alerted = 0;
+    }
+    seen = recoveries;
+    if (!alerted && recoveries - window_base >= INT_STUCK_ALERT_COUNT)
+    {
+        alerted = 1;
+        fprintf(stderr, "Warning: button interrupt stuck %d times within "
+            "%d s, check the bonnet wiring\n",
+            INT_STUCK_ALERT_COUNT, INT_STUCK_ALERT_WINDOW / 1000);
+    }
+}
+#endif
+// Integrates the current drawn since the last sample into the capacity,
+// returns whether the battery is charging
+int sample_battery(double* current)
+{
+    double ms_passed, new_capacity;
+    uint64_t sampled;
+    int charging = 0;
+
+    get_shunt_voltage(battery_gauge);
+    *current = get_current(battery_gauge);
+    // Replayed traces keep their own time
+    sampled = i2c_time();
+    ms_passed = (sampled - last_sampled) / 1e6;
+    new_capacity = last_capacity + (*current * (ms_passed / 3.6e6));
+
+    battery_current_history[0] = *current;
+    for (int i = BATTERY_SAMPLE_BUFFER - 1; i > 0; i--)
+    {
+        battery_current_history[i] = battery_current_history[i - 1];
+        if (battery_current_history[i] > 0)
+        {
+            charging = 1;
+        }
+    }
+    last_capacity = new_capacity;
+    last_sampled = sampled;
+    update_battery_status(&battery, new_capacity, *current, charging);
+    return charging;
+}
+void battery_sample_task(periodic_task* task, uint64_t now, void* data)
+{
+    double current;
+    battery_event event;
+    button_event button;
+    int charging, active = 0;
+
+    charging = sample_battery(&current);
+    event.duration = monotonic_ns() - now;
+
+    // A button change since the last sample makes it a sample taken in use
+    while (spsc_ring_pop(&button_events, &button))
+    {
+        active = 1;
+    }
+    if (active)
+    {
+        active_current += current;
+        active_samples++;
+    }
+    else
+    {
+        idle_current += current;
+        idle_samples++;
+    }
+    event.percentage = battery_status_percentage(&battery);
+    event.current = current;
+    event.charging = charging;
+    post_battery_event(&event);
+
+    if (verbose)
+    {
+        printf("Battery: %lf%% (%s), %lf V, %lf mA, %lf mAh\n",
+            100 * (last_capacity / BATTERY_CAPACITY_MAH),
+            charging ? "Charging" : "Discharging",
+            get_bus_voltage(battery_gauge),
+            current, last_capacity);
+    }
+}
+void battery_publish_task(periodic_task* task, uint64_t now, void* data)
+{
+    battery_handler(battery_status_percentage(&battery), battery.charging);
+}
+void battery_persist_task(periodic_task* task, uint64_t now, void* data)
+{
+    save_battery_capacity(last_capacity);
+}
+void battery_stats_task(periodic_task* task, uint64_t now, void* data)
+{
+    FILE* out = fopen(BATTERY_STATS_FILE ".tmp", "w");
+    if (!out)
+    {
+        return;
+    }
+    fprintf(out, "wakeups: %lu\n", battery_loop->wakeups);
+    print_scheduler_stats(out, battery_tasks);
+    fprintf(out, "current: in use=%.1fmA (%lu samples) idle=%.1fmA "
+        "(%lu samples)\n",
+        active_samples ? active_current / active_samples : 0.0,
+        active_samples, idle_samples ? idle_current / idle_samples : 0.0,
+        idle_samples);
+    if (fclose(out) == 0)
+    {
+        rename(BATTERY_STATS_FILE ".tmp", BATTERY_STATS_FILE);
+    }
+}
+void battery_stop_handler(event_loop* ev_loop, uint64_t value, void* data)
+{
+    stop_event_loop(ev_loop);
+}
+void* battery_thread_main(void* data)
+{
+    if (run_event_loop(battery_loop) != 0)
+    {
+        fprintf(stderr, "Error: battery event loop failed!\n");
+    }
+    return NULL;
+}
+void print_latency_stats(FILE* out)
+{
+    print_histogram(out, "loop wakeup latency", &loop->wakeup_latency);
+    print_histogram(out, "button dispatch", &dispatch_time);
+    print_histogram(out, "latency edge to read", &edge_to_read);
+    print_histogram(out, "latency read to emit", &read_to_emit);
+    print_histogram(out, "latency edge to emit", &edge_to_emit);
+    if (poll_timer >= 0)
+    {
+        print_histogram(out, "poll detection bound", &poller.detection);
+    }
+    if (busy_poll_window || sleep_edge_to_read.count)
+    {
+        print_histogram(out, "edge to read sleeping", &sleep_edge_to_read);
+    }
+    if (busy_poll_window && busy_poll_bus)
+    {
+        print_histogram(out, "poll detection busy poll", &spin_poll_detection);
+    }
+    else if (busy_poll_window)
+    {
+        print_histogram(out, "edge to read busy poll", &spin_edge_to_read);
+    }
+    if (devices[KEYMAP_MOUSE])
+    {
+        print_histogram(out, "pointer report jitter", &pointer_jitter);
+    }
+    if (chords.count)
+    {
+        print_histogram(out, "chord decision", &chords.decision);
+    }
+    if (turbo.buttons)
+    {
+        print_histogram(out, "turbo toggle jitter", &turbo.jitter);
+    }
+}
+void stats_task(periodic_task* task, uint64_t now, void* data)
+{
+    FILE* out = fopen(STATS_OUTPUT_FILE ".tmp", "w");
+    if (!out)
+    {
+        return;
+    }
+    fprintf(out, "wakeups: %lu\n", loop->wakeups);
+    print_scheduler_stats(out, tasks);
+    print_latency_stats(out);
+    if (battery_loop)
+    {
+        print_histogram(out, "battery sample", &battery_sample_time);
+        fprintf(out, "battery: level=%.1f%% current=%.1fmA %s samples=%lu "
+            "dropped=%lu buttons dropped=%lu\n",
+            battery_last.percentage * 100, battery_last.current,
+            battery_last.charging ? "charging" : "discharging",
+            battery_samples,
+            __atomic_load_n(&battery_events.dropped, __ATOMIC_RELAXED),
+            button_events.dropped);
+    }
+    for (int r = 0; r < route_count; r++)
+    {
+        fprintf(out, "%s: frames=%lu writes=%lu\n",
+            keymap_layout_name(routes[r].layout),
+            routes[r].device->frames, routes[r].device->writes);
+    }
+    for (int p = 0; p < player_count; p++)
+    {
+        for (int i = 0; i < KEYMAP_LAYOUTS; i++)
+        {
+            if (players[p].devices[i])
+            {
+                fprintf(out, "player %d %s: frames=%lu writes=%lu\n", p + 2,
+                    keymap_layout_name(i), players[p].devices[i]->frames,
+                    players[p].devices[i]->writes);
+            }
+        }
+    }
+    if (profile_count > 1)
+    {
+        fprintf(out, "profile: %s switches=%lu\n", profile->name,
+            profile_switches);
+    }
+    if (chords.count)
+    {
+        fprintf(out, "chords: over budget=%lu\n", chords.over_budget);
+    }
+    if (replay_path)
+    {
+        print_replay_report(out, &replay);
+    }
+    if (recorder.file)
+    {
+        fprintf(out, "recording: entries=%lu\n", recorder.records);
+    }
+    print_i2c_stats(out);
+    if (rt_priority)
+    {
+        fprintf(out, "realtime: priority=%u demoted=%d overloads=%lu "
+            "restores=%lu\n", rt_priority,
+            __atomic_load_n(&rt_watchdog.demoted, __ATOMIC_RELAXED),
+            __atomic_load_n(&rt_watchdog.overloads, __ATOMIC_RELAXED),
+            __atomic_load_n(&rt_watchdog.restores, __ATOMIC_RELAXED));
+    }
+    if (stick.rate)
+    {
+        fprintf(out, "analog: conversions=%lu reports=%lu errors=%lu\n",
+            stick.conversions, stick.reports, stick.errors);
+    }
+    if (turbo.buttons)
+    {
+        fprintf(out, "turbo: toggles=%lu batches=%lu\n",
+            turbo.toggles, turbo.batches);
+    }
+    if (gestures.gestures | gestures.repeats)
+    {
+        fprintf(out, "gestures: long=%lu double=%lu repeats=%lu\n",
+            gestures.long_presses, gestures.double_taps,
+            gestures.repeats_sent);
+    }
+    if (commands.count)
+    {
+        fprintf(out, "commands: queued=%lu limited=%lu spawned=%lu "
+            "failed=%lu exited=%lu\n", commands.queued, commands.limited,
+            __atomic_load_n(&commands.spawned, __ATOMIC_RELAXED),
+            __atomic_load_n(&commands.failed, __ATOMIC_RELAXED),
+            __atomic_load_n(&commands.exited, __ATOMIC_RELAXED));
+    }
+    if (busy_poll_window)
+    {
+        // Bus reads only know when a change was seen, not when it happened
+        const histogram* busy = busy_poll_bus
+            ? &spin_poll_detection : &spin_edge_to_read;
+        const char* label = busy_poll_bus ? "busy detection" : "busy";
+        fprintf(out, "busy poll: windows=%lu passes=%lu p50 sleeping=%.1fus "
+            "%s=%.1fus p99 sleeping=%.1fus %s=%.1fus\n",
+            busy_poll_windows, loop->spins,
+            histogram_percentile(&sleep_edge_to_read, 0.5) / 1e3,
+            label, histogram_percentile(busy, 0.5) / 1e3,
+            histogram_percentile(&sleep_edge_to_read, 0.99) / 1e3,
+            label, histogram_percentile(busy, 0.99) / 1e3);
+    }
+    if (poll_timer >= 0)
+    {
+        fprintf(out, "polling: reads=%lu fast=%lu rate=%.1f/s\n",
+            poller.reads, poller.fast_reads, button_poll_rate(&poller, now));
+    }
+    if (devices[KEYMAP_MOUSE])
+    {
+        fprintf(out, "pointer: reports=%lu skipped=%lu\n",
+            pointer.reports, pointer.skipped);
+    }
+    #ifdef GPIO_INT
+    if (buttons && buttons->int_pin)
+    {
+        fprintf(out, "interrupt recoveries: %lu check errors: %lu\n",
+            interrupt_recoveries(), int_check_errors);
+    }
+    #endif
+    if (buttons)
+    {
+        fprintf(out, "bounces:");
+        for (int i = 0; i < DEBOUNCE_BUTTONS; i++)
+        {
+            if (keymap_button_name(i))
+            {
+                fprintf(out, " %s=%lu", keymap_button_name(i),
+                    debounce.bounces[i]);
+            }
+        }
+        fprintf(out, "\n");
+    }
+    if (fclose(out) == 0)
+    {
+        rename(STATS_OUTPUT_FILE ".tmp", STATS_OUTPUT_FILE);
+    }
+    if (verbose)
+    {
+        print_scheduler_stats(stdout, tasks);
+        print_latency_stats(stdout);
+    }
+}
+// Runs the battery estimator over the gauge readings of an I2C trace as fast
+// as they replay, printing each sample
+int rerun_battery_trace()
+{
+    uint64_t start;
+    double current;
+    int charging;
+    battery_gauge = initialize_ina219(
+        BATTERY_GAUGE_ADDR, I2C_PATH, BUS_VOLTAGE_RANGE_16V_5A);
+    if (!battery_gauge)
+    {
+        fprintf(stderr, "Error: %s has no battery gauge setup!\n",
+            i2c_replay_path);
+        close_resources();
+        return -1;
+    }
+    // Starts from the voltage estimate read when the trace was taken
+    memset(battery_current_history, 0,
+        BATTERY_SAMPLE_BUFFER * sizeof(double));
+    last_capacity = estimate_battery_percentage(
+        BATTERY_MIN_VOLTAGE, battery_gauge) * BATTERY_CAPACITY_MAH;
+    start = last_sampled = i2c_time();
+    update_battery_status(&battery, last_capacity, 0, 0);
+
+    printf("# time (s), capacity (mAh), level (%%), current (mA), status\n");
+    for (;;)
+    {
+        charging = sample_battery(&current);
+        if (i2c_replay_done())
+        {
+            break;
+        }
+        printf("%.3f %.1f %.1f %.1f %s\n", (last_sampled - start) / 1e9,
+            last_capacity, battery_status_percentage(&battery) * 100,
+            current, charging ? "charging" : "discharging");
+    }
+    print_i2c_stats(stdout);
+    close_resources();
+    return 0;
+}
+#ifdef BATTERY_FUSE
+void battery_fs_handler(event_loop* ev_loop, uint64_t value, void* data)
+{
+    if (process_battery_fs(battery_files) != 0)
+    {
+        fprintf(stderr, "Error: "BATTERY_OUTPUT_DIR" was unmounted\n");
+        remove_event_fd(ev_loop, battery_fs_fd(battery_files));
+    }
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    const int exit_signals[] = { SIGTERM, SIGINT, SIGQUIT };
+    const int profile_signals[] = { SIGUSR1 };
+    struct timespec end_ts;
+    pthread_attr_t attr;
+    double estimate;
+    const char* config_path = CONFIG_PATH;
+    const char* profile_name = DEFAULT_PROFILE;
+    int enable_buttons = 1, enable_battery = 1, use_gamepad = 0, opt;
+
+    // Handle flags
+    while ((opt = getopt(argc, argv, "hvbsfgc:p:r:R:t:T:F:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                enable_battery = 0;
+                break;
+            case 's':
+                enable_buttons = 0;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'f':
+                #ifdef BATTERY_FUSE
+                use_battery_fs = 1;
+                break;
+                #else
+                fprintf(stderr, "Error: GGA built without FUSE support\n");
+                return -1;
+                #endif
+            case 'g':
+                use_gamepad = 1;
+                break;
+            case 'c':
+                config_path = optarg;
+                break;
+            case 'p':
+                profile_name = optarg;
+                break;
+            case 'r':
+                record_path = optarg;
+                break;
+            case 'R':
+                replay_path = optarg;
+                break;
+            case 't':
+                i2c_trace_path = optarg;
+                break;
+            case 'F':
+                i2c_replay_fast = 1;
+                // Fall through
+            case 'T':
+                i2c_replay_path = optarg;
+                break;
+            case 'h':
+                printf("GGA: hardware handler for GGA console.\n"
+                    "  -h Display this help text\n"
+                    "  -v Increase verbosity\n"
+                    "  -b Don't enable battery monitoring\n"
+                    "  -s Don't enable buttons monitoring\n"
+                    "  -f Serve battery files from memory with FUSE\n"
+                    "  -g Act as a gamepad instead of a keyboard\n"
+                    "  -c <file> Read configuration from file "
+                    "(default " CONFIG_PATH ")\n"
+                    "  -p <name> Start with the named input profile\n"
+                    "  -r <file> Record button states to file\n"
+                    "  -R <file> Replay recorded button states instead of "
+                    "reading the buttons\n"
+                    "  -t <file> Trace I2C transfers to file\n"
+                    "  -T <file> Replay traced I2C transfers in real time "
+                    "instead of using the bus\n"
+                    "  -F <file> Rerun the battery estimate over traced I2C "
+                    "transfers as fast as possible\n");
+                return 0;
+            default:
+                return -1;
+        }
+    }
+
+    // Read configuration, a missing file keeps the defaults
+    default_keymap_profile(&profiles[0], DEFAULT_PROFILE);
+    reset_histogram(&dispatch_time);
+    reset_histogram(&edge_to_read);
+    reset_histogram(&read_to_emit);
+    reset_histogram(&edge_to_emit);
+    reset_histogram(&pointer_jitter);
+    reset_histogram(&spin_edge_to_read);
+    reset_histogram(&sleep_edge_to_read);
+    reset_histogram(&spin_poll_detection);
+    reset_histogram(&battery_sample_time);
+    init_chord_engine(&chords);
+    init_turbo(&turbo);
+    init_analog_stick(&stick);
+    init_gestures(&gestures);
+    init_command_runner(&commands);
+    opt = parse_config_file(config_path, config_entry_handler, NULL);
+    if (opt > 0)
+    {
+        fprintf(stderr, "Error: %s line %d is invalid\n", config_path, opt);
+        return -1;
+    }
+    // Chords may follow the shift line, so shifts are checked at the end
+    if (unchorded_shifts(&chords))
+    {
+        uint16_t bits = unchorded_shifts(&chords);
+        for (; bits; bits &= bits - 1)
+        {
+            fprintf(stderr, "Error: %s [chords] shift %s is not part of any "
+                "chord\n", config_path,
+                keymap_button_name(__builtin_ctz(bits)));
+        }
+        return -1;
+    }
+    // Layouts a profile leaves alone follow the default one
+    for (int p = 1; p < profile_count; p++)
+    {
+        inherit_keymap_profile(&profiles[p], &profiles[0]);
+    }
+    profile = find_profile(profile_name);
+    if (!profile)
+    {
+        fprintf(stderr, "Error: profile %s is not configured\n", profile_name);
+        return -1;
+    }
+    if (use_gamepad) device_layouts = 1 << KEYMAP_GAMEPAD;
+    if (record_path && replay_path)
+    {
+        fprintf(stderr, "Error: cannot record and replay at once\n");
+        return -1;
+    }
+    // Traced before any device is set up, so replays see the setup too
+    if (i2c_trace_path && i2c_replay_path)
+    {
+        fprintf(stderr, "Error: cannot trace and replay I2C at once\n");
+        return -1;
+    }
+    if (i2c_trace_path && trace_i2c(i2c_trace_path) != 0)
+    {
+        fprintf(stderr, "Error: cannot trace I2C to %s\n", i2c_trace_path);
+        return -1;
+    }
+    if (i2c_replay_path && replay_i2c(i2c_replay_path, i2c_replay_fast
+            ? I2C_REPLAY_FAST : I2C_REPLAY_REALTIME) != 0)
+    {
+        fprintf(stderr, "Error: cannot replay %s\n", i2c_replay_path);
+        return -1;
+    }
+    if (i2c_replay_fast)
+    {
+        return rerun_battery_trace();
+    }
+    if (int_pin_count != 1 && int_pin_count != bonnet_count)
+    {
+        fprintf(stderr, "Error: give one interrupt pin, or one per "
+            "expander\n");
+        return -1;
+    }
+    if (set_chord_window(&chords, chord_window, chord_budget) != 0)
+    {
+        fprintf(stderr, "Error: chord window exceeds its latency budget\n");
+        return -1;
+    }
+    // Hotkeys go to the keyboard, or the first device without one
+    if (!(device_layouts & (1 << KEYMAP_KEYBOARD)))
+    {
+        hotkey_layout = __builtin_ctz(device_layouts);
+    }
+
+    // Set up event loop, with exit signals delivered through it
+    loop = create_event_loop();
+    if (!loop || add_event_signals(loop, exit_signals, 3, exit_handler, NULL)
+        || add_event_signals(loop, profile_signals, 1, profile_handler, NULL)
+        || !(tasks = create_scheduler(loop))
+        || !add_periodic_task(tasks, "stats", STATS_INTERVAL, stats_task, NULL))
+    {
+        fprintf(stderr, "Error: cannot create event loop!\n");
+        close_resources();
+        return -1;
+    }
+  
+    if (enable_buttons)
+    {
+        // Set up input devices, libevdev is the fallback backend
+        if (create_player_devices(devices, 1, device_layouts) != 0)
+        {
+            close_resources();
+            return -1;
+        }
+        for (int i = 0; i < KEYMAP_LAYOUTS; i++)
+        {
+            if (devices[i])
+            {
+                routes[route_count].layout = i;
+                routes[route_count].device = devices[i];
+                route_count++;
+            }
+        }
+        // Initialize arcade bonnet, a replay stands in for the expanders
+        if (!replay_path
+            && !(buttons = configure_arcade_bonnet(bonnet_addrs[0], I2C_PATH)))
+        {
+            fprintf(stderr, "Error: cannot setup arcade bonnet IC!\n");
+            close_resources();
+            return -1;
+        }
+        // Further players get their own expander and devices, without a mouse
+        // as pointer motion belongs to player 1
+        for (unsigned int n = 1; n < bonnet_count; n++)
+        {
+            player* p = &players[player_count++];
+            p->debounce_timer = -1;
+            if (create_player_devices(p->devices, n + 1,
+                    device_layouts & ~(1 << KEYMAP_MOUSE)) != 0)
+            {
+                close_resources();
+                return -1;
+            }
+            p->bonnet = replay_path ? NULL
+                : configure_arcade_bonnet(bonnet_addrs[n], I2C_PATH);
+            if (!replay_path && !p->bonnet)
+            {
+                fprintf(stderr, "Error: cannot setup expander 0x%02x!\n",
+                    bonnet_addrs[n]);
+                close_resources();
+                return -1;
+            }
+            p->last_state = p->bonnet ? p->bonnet->state
+                : (arcade_buttons)0xffff;
+            init_debouncer(&p->debounce, debounce_setting, debounce_window,
+                p->last_state);
+            p->debounce_timer = add_event_timer(loop,
+                player_debounce_timer_handler, p);
+            if (p->debounce_timer < 0)
+            {
+                fprintf(stderr, "Error: cannot create debounce timer!\n");
+                close_resources();
+                return -1;
+            }
+        }
+        last_state = buttons ? buttons->state : (arcade_buttons)0xffff;
+        init_debouncer(&debounce, debounce_setting, debounce_window,
+            last_state);
+        debounce_timer = add_event_timer(loop, debounce_timer_handler, NULL);
+        if (debounce_timer < 0)
+        {
+            fprintf(stderr, "Error: cannot create debounce timer!\n");
+            close_resources();
+            return -1;
+        }
+        if (chords.count)
+        {
+            chord_timer = add_event_timer(loop, chord_timer_handler, NULL);
+            if (chord_timer < 0)
+            {
+                fprintf(stderr, "Error: cannot create chord timer!\n");
+                close_resources();
+                return -1;
+            }
+        }
+        if (gestures.gestures | gestures.repeats)
+        {
+            gesture_timer = add_event_timer(loop, gesture_timer_handler, NULL);
+            if (gesture_timer < 0)
+            {
+                fprintf(stderr, "Error: cannot create gesture timer!\n");
+                close_resources();
+                return -1;
+            }
+        }
+        if (turbo.buttons)
+        {
+            // Only armed while a turbo button is held
+            turbo_timer = add_event_timer(loop, turbo_timer_handler, NULL);
+            if (turbo_timer < 0)
+            {
+                fprintf(stderr, "Error: cannot create turbo timer!\n");
+                close_resources();
+                return -1;
+            }
+        }
+        if (devices[KEYMAP_MOUSE])
+        {
+            // Only armed while a pointer direction is held
+            init_pointer_motion(&pointer, pointer_rate, pointer_min_speed,
+                pointer_max_speed, pointer_accel_time, pointer_accel_curve);
+            pointer_timer = add_event_timer(loop, pointer_timer_handler, NULL);
+            if (pointer_timer < 0)
+            {
+                fprintf(stderr, "Error: cannot create pointer timer!\n");
+                close_resources();
+                return -1;
+            }
+        }
+        if (stick.rate)
+        {
+            // The stick drives the gamepad's left stick axes
+            if (!devices[KEYMAP_GAMEPAD])
+            {
+                fprintf(stderr, "Error: analog stick needs the gamepad "
+                    "device!\n");
+                close_resources();
+                return -1;
+            }
+            if (open_analog_stick(&stick, stick_addr, I2C_PATH) != 0)
+            {
+                fprintf(stderr, "Error: cannot setup analog stick ADC!\n");
+                close_resources();
+                return -1;
+            }
+            stick_next = monotonic_ns() + analog_stick_period(&stick);
+            stick_timer = add_event_timer(loop, stick_timer_handler, NULL);
+            if (stick_timer < 0
+                || arm_event_timer(loop, stick_timer, stick_next) != 0)
+            {
+                fprintf(stderr, "Error: cannot create analog stick timer!\n");
+                close_resources();
+                return -1;
+            }
+        }
+        if (record_path)
+        {
+            arcade_buttons states[ARCADE_BONNETS_MAX] = { last_state };
+            for (int p = 0; p < player_count; p++)
+            {
+                states[p + 1] = players[p].last_state;
+            }
+            if (open_input_recorder(&recorder, record_path, player_count + 1,
+                    states, monotonic_ns()) != 0)
+            {
+                fprintf(stderr, "Error: cannot record to %s\n", record_path);
+                close_resources();
+                return -1;
+            }
+        }
+        if (commands.count)
+        {
+            int ret = start_command_runner(&commands);
+            if (ret != 0)
+            {
+                fprintf(stderr, ret == -3
+                    ? "Error: commands need pidfd_open, Linux 5.3 or later!\n"
+                    : "Error: cannot start command runner!\n");
+                close_resources();
+                return -1;
+            }
+        }
+        #ifdef GPIO_INT
+        shared_line = int_pin_count == 1 && player_count;
+        #endif
+        if (replay_path)
+        {
+            // Starts once the new devices had time to be picked up
+            if (open_input_replay(&replay, replay_path,
+                    monotonic_ns() + REPLAY_LEAD * 1000000ULL) != 0)
+            {
+                fprintf(stderr, "Error: cannot replay %s\n", replay_path);
+                close_resources();
+                return -1;
+            }
+            if (replay.players > player_count + 1)
+            {
+                printf("Replaying player 1 to %d of %d\n", player_count + 1,
+                    replay.players);
+            }
+            replay_timer = add_event_timer(loop, replay_timer_handler, NULL);
+            if (replay_timer < 0 || arm_event_timer(loop, replay_timer,
+                    replay.due - REPLAY_SPIN * 1000ULL) != 0)
+            {
+                fprintf(stderr, "Error: cannot create replay timer!\n");
+                close_resources();
+                return -1;
+            }
+        }
+        #ifdef GPIO_INT
+        // Setup GPIO interrupts, falling back to polling without them. A
+        // replayed bus has no interrupt line behind it
+        else if (!i2c_replay_path
+            && configure_button_interrupt(GPIO_PATH, int_pins[0],
+                buttons) == 0
+            && add_event_fd(loop, button_interrupt_fd(buttons), EPOLLIN,
+                button_update_handler, NULL) == 0
+            && add_periodic_task(tasks, "int-watchdog",
+                INT_WATCHDOG_INTERVAL, int_watchdog_task, NULL))
+        {
+            for (int p = 0; p < player_count && !shared_line; p++)
+            {
+                if (configure_button_interrupt(GPIO_PATH, int_pins[p + 1],
+                        players[p].bonnet) != 0
+                    || add_event_fd(loop, button_interrupt_fd(
+                        players[p].bonnet), EPOLLIN, player_interrupt_handler,
+                        &players[p]) != 0)
+                {
+                    fprintf(stderr, "Error: cannot request interrupt pin "
+                        "%u!\n", int_pins[p + 1]);
+                    close_resources();
+                    return -1;
+                }
+                consume_button_interrupt(players[p].bonnet);
+                process_player_update(&players[p],
+                    read_buttons_pressed(players[p].bonnet));
+            }
+            // Catch any press made while the lines were being requested,
+            // without waiting for an edge that may never come
+            read_line_expanders(0);
+        }
+        #endif
+        else if ((poll_timer = add_event_timer(loop, button_poll_handler,
+                NULL)) < 0
+            || arm_event_timer(loop, poll_timer, init_button_poller(&poller,
+                poll_fast, poll_slow, poll_idle, monotonic_ns())) != 0)
+        {
+            fprintf(stderr, "Error: cannot create button poll timer!\n");
+            close_resources();
+            return -1;
+        }
+    }
+
+    if (enable_battery)
+    {
+        // The battery thread gets its own loop, woken by the input loop only
+        // to stop
+        battery_stop_fd = eventfd(0, EFD_CLOEXEC);
+        battery_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (battery_stop_fd < 0 || battery_event_fd < 0
+            || init_spsc_ring(&battery_events, BATTERY_EVENT_RING,
+                sizeof(battery_event)) != 0
+            || init_spsc_ring(&button_events, BUTTON_EVENT_RING,
+                sizeof(button_event)) != 0
+            || add_event_fd(loop, battery_event_fd, EPOLLIN,
+                battery_event_handler, NULL) != 0
+            || !(battery_loop = create_event_loop())
+            || add_event_fd(battery_loop, battery_stop_fd, EPOLLIN,
+                battery_stop_handler, NULL) != 0
+            || !(battery_tasks = create_scheduler(battery_loop))
+            || !add_periodic_task(battery_tasks, "stats", STATS_INTERVAL,
+                battery_stats_task, NULL))
+        {
+            fprintf(stderr, "Error: cannot create battery event loop!\n");
+            close_resources();
+            return -1;
+        }
+        // Drop a stale mount left behind by a crashed instance
+        if (use_battery_fs) umount2(BATTERY_OUTPUT_DIR, MNT_DETACH);
+        // Setup battery logging files directory
+        if (mkdir(BATTERY_OUTPUT_DIR,
+            S_ISVTX | S_IRWXU | S_IWGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0)
+        {
+            if (errno != EEXIST)
+            {
+                fprintf(stderr, "Error: cannot create "BATTERY_OUTPUT_DIR"\n");
+                close_resources();
+                return -1;
+            }
+            else if (chmod(BATTERY_OUTPUT_DIR,
+                S_ISVTX | S_IRWXU | S_IWGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0)
+            {
+                fprintf(stderr, "Error: already exits "BATTERY_OUTPUT_DIR"\n");
+                close_resources();
+                return -1;
+            }
+        }
+        // Initialize battery gauge
+        battery_gauge = initialize_ina219(
+            BATTERY_GAUGE_ADDR, I2C_PATH, BUS_VOLTAGE_RANGE_16V_5A);
+        if (!battery_gauge)
+        {
+            fprintf(stderr, "Error: cannot setup battery gauge IC!\n");
+            close_resources();
+            return -1;
+        }
+        // Set up battery monitoring
+        memset(battery_current_history, 0,
+            BATTERY_SAMPLE_BUFFER * sizeof(double));
+        // The voltage is read even with a saved capacity so traces start
+        // with it, replays start from it as the trace did not save anything
+        last_capacity = i2c_replay_path ? -1 : load_battery_capacity();
+        estimate = estimate_battery_percentage(
+            BATTERY_MIN_VOLTAGE, battery_gauge) * BATTERY_CAPACITY_MAH;
+        // A saved capacity far off the voltage is wrong, e.g. after the
+        // battery was swapped or charged elsewhere
+        if (last_capacity < 0 || fabs(last_capacity - estimate)
+            > BATTERY_STATE_MARGIN * BATTERY_CAPACITY_MAH)
+        {
+            last_capacity = estimate;
+        }
+        last_sampled = i2c_time();
+        update_battery_status(&battery, last_capacity, 0, 0);
+        if (!add_periodic_task(battery_tasks, "battery-sample",
+                BATTERY_UPDATE_INTERVAL, battery_sample_task, NULL)
+            || !add_periodic_task(battery_tasks, "battery-publish",
+                BATTERY_PUBLISH_INTERVAL, battery_publish_task, NULL)
+            || (!i2c_replay_path && !add_periodic_task(battery_tasks,
+                "battery-persist", BATTERY_PERSIST_INTERVAL,
+                battery_persist_task, NULL)))
+        {
+            fprintf(stderr, "Error: cannot create battery tasks!\n");
+            close_resources();
+            return -1;
+        }
+        #ifdef BATTERY_FUSE
+        if (use_battery_fs)
+        {
+            battery_files = mount_battery_fs(BATTERY_OUTPUT_DIR, &battery);
+            if (!battery_files || add_event_fd(
+                battery_loop, battery_fs_fd(battery_files), EPOLLIN,
+                battery_fs_handler, NULL) != 0)
+            {
+                fprintf(stderr, "Error: cannot mount "BATTERY_OUTPUT_DIR"\n");
+                close_resources();
+                return -1;
+            }
+        }
+        #endif
+        // Signals stay blocked on the thread, they go to the input loop
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, BATTERY_STACK_SIZE);
+        opt = pthread_create(&battery_thread, &attr, battery_thread_main,
+            NULL);
+        pthread_attr_destroy(&attr);
+        if (opt != 0)
+        {
+            fprintf(stderr, "Error: cannot start battery thread!\n");
+            close_resources();
+            return -1;
+        }
+        battery_thread_started = 1;
+    }
+
+    // Pinned last, so threads started above keep running on any CPU
+    if (input_cpu >= 0 && pin_to_cpu(input_cpu) != 0)
+    {
+        fprintf(stderr, "Error: cannot pin to CPU %d!\n", input_cpu);
+        close_resources();
+        return -1;
+    }
+    // Everything is allocated by now, so the loop never waits on a page fault
+    if (rt_lock_memory && lock_memory(REALTIME_STACK_PREFAULT) != 0)
+    {
+        fprintf(stderr, "Error: cannot lock memory!\n");
+        close_resources();
+        return -1;
+    }
+    if (rt_priority && (set_realtime_priority(rt_priority) != 0
+        || start_realtime_watchdog(&rt_watchdog, loop, rt_priority,
+            rt_watchdog_ms, rt_max_load) != 0))
+    {
+        fprintf(stderr, "Error: cannot set realtime priority %u!\n",
+            rt_priority);
+        close_resources();
+        return -1;
+    }
+
+    printf("Started GGA\n");
+    if (run_event_loop(loop) != 0)
+    {
+        fprintf(stderr, "Error: event loop failed!\n");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end_ts);
+    printf("Exiting GGA after %lu wakeups (%.2f/s)...\n", loop->wakeups,
+        loop->wakeups / ((end_ts.tv_sec - loop->epoch.tv_sec)
+            + (end_ts.tv_nsec - loop->epoch.tv_nsec) / 1e9));
+    // The battery thread owns the capacity until it stops
+    stop_battery_thread();
+    if (battery_gauge && !i2c_replay_path)
+    {
+        save_battery_capacity(last_capacity);
+    }
+    if (replay_path) print_replay_report(stdout, &replay);
+    close_resources();
+    return battery_failed ? -1 : 0;
 } 
@@ -0,0 +1,102 @@
+/*
+ * Implements accelerated pointer motion from held digital directions
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "pointer.h"
+
+/*
+ * Private helper functions
+ */
+static double pointer_speed(const pointer_motion* pointer, uint64_t now)
+{
+    double progress = 1;
+    if (pointer->ramp && now - pointer->held_since < pointer->ramp)
+    {
+        progress = (double)(now - pointer->held_since) / pointer->ramp;
+    }
+    return pointer->min_speed + (pointer->max_speed - pointer->min_speed)
+        * pow(progress, pointer->curve);
+}
+
+/*
+ * Sets up `pointer` reporting at `rate_hz` while a direction is held, speeding
+ * up from `min_speed` to `max_speed` pixels per second over `ramp_ms` along
+ * t^`curve`
+ */
+void init_pointer_motion(pointer_motion* pointer, unsigned int rate_hz,
+    double min_speed, double max_speed, unsigned int ramp_ms, double curve)
+{
+    memset(pointer, 0, sizeof(pointer_motion));
+    pointer->period = 1000000000ULL / (rate_hz ? rate_hz : 1);
+    pointer->min_speed = min_speed;
+    pointer->max_speed = max_speed < min_speed ? min_speed : max_speed;
+    pointer->ramp = ramp_ms * 1000000ULL;
+    pointer->curve = curve;
+}
+
+/*
+ * Changes the held direction at `now` (CLOCK_MONOTONIC ns). Returns the
+ * deadline of the next report, `now` if motion just started, or 0 if the
+ * pointer stopped and no timer is needed
+ */
+uint64_t set_pointer_direction(pointer_motion* pointer, int x, int y,
+    uint64_t now)
+{
+    pointer->x = x;
+    pointer->y = y;
+    if (!x && !y)
+    {
+        pointer->next_report = 0;
+        pointer->carry_x = 0;
+        pointer->carry_y = 0;
+    }
+    else if (!pointer->next_report)
+    {
+        // Move on the press itself, later reports follow on the rate grid
+        pointer->held_since = now;
+        pointer->next_report = now;
+    }
+    return pointer->next_report;
+}
+
+/*
+ * Advances the motion to the report due at `now`, storing the whole pixels to
+ * move in `dx` and `dy`. Returns the deadline of the following report, or 0
+ * if the pointer is idle
+ */
+uint64_t pointer_motion_step(pointer_motion* pointer, uint64_t now,
+    int* dx, int* dy)
+{
+    double distance;
+    unsigned int periods = 1;
+    *dx = 0;
+    *dy = 0;
+    if (!pointer->next_report)
+    {
+        return 0;
+    }
+
+    // A late timer covers the reports it missed, so the speed holds
+    pointer->next_report += pointer->period;
+    while (pointer->next_report <= now)
+    {
+        pointer->next_report += pointer->period;
+        pointer->skipped++;
+        periods++;
+    }
+
+    // Diagonals move at the same speed as straight lines
+    distance = pointer_speed(pointer, now) * pointer->period * periods / 1e9;
+    if (pointer->x && pointer->y) distance *= M_SQRT1_2;
+    pointer->carry_x += distance * pointer->x;
+    pointer->carry_y += distance * pointer->y;
+    *dx = (int)pointer->carry_x;
+    *dy = (int)pointer->carry_y;
+    pointer->carry_x -= *dx;
+    pointer->carry_y -= *dy;
+    pointer->reports++;
+    return pointer->next_report;
+}
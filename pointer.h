@@ -0,0 +1,48 @@
+/*
+ * Implements accelerated pointer motion from held digital directions
+ */
+
+#ifndef POINTER_H
+#define POINTER_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint64_t period;            // ns between motion reports
+    double min_speed;           // Pixels per second when a direction is pressed
+    double max_speed;           // Pixels per second after `ramp`
+    uint64_t ramp;              // ns to accelerate from min to max speed
+    double curve;               // Exponent of the acceleration curve
+    int x, y;                   // Held direction, -1, 0 or 1
+    uint64_t held_since;        // Time motion started
+    uint64_t next_report;       // Deadline of the next report, 0 when idle
+    double carry_x, carry_y;    // Sub pixel motion not yet reported
+    unsigned long reports;
+    unsigned long skipped;      // Reports dropped because the timer ran late
+} pointer_motion;
+
+/*
+ * Sets up `pointer` reporting at `rate_hz` while a direction is held, speeding
+ * up from `min_speed` to `max_speed` pixels per second over `ramp_ms` along
+ * t^`curve`
+ */
+void init_pointer_motion(pointer_motion* pointer, unsigned int rate_hz,
+    double min_speed, double max_speed, unsigned int ramp_ms, double curve);
+
+/*
+ * Changes the held direction at `now` (CLOCK_MONOTONIC ns). Returns the
+ * deadline of the next report, `now` if motion just started, or 0 if the
+ * pointer stopped and no timer is needed
+ */
+uint64_t set_pointer_direction(pointer_motion* pointer, int x, int y,
+    uint64_t now);
+
+/*
+ * Advances the motion to the report due at `now`, storing the whole pixels to
+ * move in `dx` and `dy`. Returns the deadline of the following report, or 0
+ * if the pointer is idle
+ */
+uint64_t pointer_motion_step(pointer_motion* pointer, uint64_t now,
+    int* dx, int* dy);
+
+#endif
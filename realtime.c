@@ -0,0 +1,214 @@
+/*
+ * Implements realtime scheduling, memory locking and CPU pinning for the
+ * input loop, with a watchdog demoting it if it stops sleeping
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include "realtime.h"
+
+// The watchdog only polls, it needs little stack when memory is locked
+#define WATCHDOG_STACK_SIZE (PTHREAD_STACK_MIN + 64 * 1024)
+
+/*
+ * Private helper functions
+ */
+static uint64_t thread_cpu_ns(clockid_t clock)
+{
+    struct timespec used;
+    clock_gettime(clock, &used);
+    return used.tv_sec * 1000000000ULL + used.tv_nsec;
+}
+
+static void* watchdog_thread(void* data)
+{
+    realtime_watchdog* watchdog = data;
+    struct pollfd stop = { watchdog->stop_fd, POLLIN, 0 };
+    uint64_t used = thread_cpu_ns(watchdog->target_clock);
+    uint64_t spun = __atomic_load_n(&watchdog->loop->spin_ns, __ATOMIC_RELAXED);
+    uint64_t checked = monotonic_ns();
+
+    while (poll(&stop, 1, watchdog->interval / 1000000) == 0)
+    {
+        uint64_t now = monotonic_ns();
+        uint64_t now_used = thread_cpu_ns(watchdog->target_clock);
+        uint64_t now_spun = __atomic_load_n(&watchdog->loop->spin_ns,
+            __ATOMIC_RELAXED);
+        uint64_t busy = now_used - used, spinning = now_spun - spun;
+        int overloaded;
+        used = now_used;
+        spun = now_spun;
+
+        // Busy polling runs flat out on purpose, only the rest is a busy loop
+        busy = busy > spinning ? busy - spinning : 0;
+        overloaded = busy * 100 > (now - checked) * watchdog->max_load;
+        if (overloaded)
+        {
+            __atomic_add_fetch(&watchdog->overloads, 1, __ATOMIC_RELAXED);
+        }
+        if (overloaded && !watchdog->demoted)
+        {
+            struct sched_param param = { 0 };
+            if (pthread_setschedparam(watchdog->target, SCHED_OTHER, &param)
+                == 0)
+            {
+                __atomic_store_n(&watchdog->demoted, 1, __ATOMIC_RELAXED);
+                fprintf(stderr, "Error: input loop busy for %llu of %llu ms, "
+                    "dropped realtime priority\n",
+                    (unsigned long long)(busy / 1000000),
+                    (unsigned long long)((now - checked) / 1000000));
+            }
+        }
+        else if (!overloaded && watchdog->demoted)
+        {
+            // The loop sleeps again, a passing burst should not cost it the
+            // priority for good
+            struct sched_param param = {
+                .sched_priority = watchdog->priority };
+            if (pthread_setschedparam(watchdog->target,
+                    SCHED_FIFO | SCHED_RESET_ON_FORK, &param) == 0)
+            {
+                __atomic_store_n(&watchdog->demoted, 0, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&watchdog->restores, 1, __ATOMIC_RELAXED);
+                fprintf(stderr, "Warning: input loop is idle again, "
+                    "restored realtime priority\n");
+            }
+        }
+        checked = now;
+    }
+    return NULL;
+}
+
+// Kept out of line so the touched frame is really on the stack
+static __attribute__((noinline)) void touch_stack(size_t bytes)
+{
+    char frame[bytes];
+    for (size_t i = 0; i < bytes; i += 4096)
+    {
+        frame[i] = 0;
+    }
+    // Keeps the stores from being optimised away
+    __asm__ volatile("" : : "r"(frame) : "memory");
+}
+
+/*
+ * Restricts the calling thread to `cpu`, returns zero on success, and a
+ * negative value on errors
+ */
+int pin_to_cpu(int cpu)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0 ? 0 : -1;
+}
+
+/*
+ * Locks current and future memory into RAM and touches `stack_bytes` of the
+ * calling thread's stack so they are already mapped. Returns zero on success,
+ * and a negative value on errors
+ */
+int lock_memory(size_t stack_bytes)
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        return -1;
+    }
+    touch_stack(stack_bytes);
+    return 0;
+}
+
+/*
+ * Runs the calling thread SCHED_FIFO at `priority` (1 - REALTIME_MAX_PRIORITY)
+ * without passing it on to threads or processes it starts. Returns zero on
+ * success, and a negative value on errors
+ */
+int set_realtime_priority(int priority)
+{
+    struct sched_param param = { .sched_priority = priority };
+    if (priority < 1 || priority > REALTIME_MAX_PRIORITY)
+    {
+        return -1;
+    }
+    // Commands spawned later must not inherit the priority
+    if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &param) != 0)
+    {
+        return -2;
+    }
+    return 0;
+}
+
+/*
+ * Starts a watchdog one priority above `priority` that checks the calling
+ * thread every `interval_ms`, and puts it back to SCHED_OTHER if it used more
+ * than `max_load` percent of a CPU besides the time `loop` spent spinning. The
+ * priority is restored after a check within the limit. Returns zero on
+ * success, and a negative value on errors
+ */
+int start_realtime_watchdog(realtime_watchdog* watchdog, const event_loop* loop,
+    int priority, unsigned int interval_ms, unsigned int max_load)
+{
+    struct sched_param param = { .sched_priority = priority + 1 };
+    pthread_attr_t attr;
+    int ret;
+
+    memset(watchdog, 0, sizeof(realtime_watchdog));
+    watchdog->target = pthread_self();
+    watchdog->loop = loop;
+    watchdog->priority = priority;
+    watchdog->interval = interval_ms * 1000000ULL;
+    watchdog->max_load = max_load;
+    if (pthread_getcpuclockid(watchdog->target, &watchdog->target_clock) != 0)
+    {
+        return -1;
+    }
+    watchdog->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (watchdog->stop_fd < 0)
+    {
+        return -2;
+    }
+
+    // Above the loop, so a loop stuck on its CPU cannot starve it
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WATCHDOG_STACK_SIZE);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+    ret = pthread_create(&watchdog->thread, &attr, watchdog_thread, watchdog);
+    pthread_attr_destroy(&attr);
+    if (ret != 0)
+    {
+        close(watchdog->stop_fd);
+        return -3;
+    }
+    watchdog->started = 1;
+    return 0;
+}
+
+/*
+ * Stops the watchdog if it was started
+ */
+void stop_realtime_watchdog(realtime_watchdog* watchdog)
+{
+    uint64_t one = 1;
+    if (!watchdog->started)
+    {
+        return;
+    }
+    if (write(watchdog->stop_fd, &one, sizeof(one)) == sizeof(one))
+    {
+        pthread_join(watchdog->thread, NULL);
+    }
+    close(watchdog->stop_fd);
+    watchdog->started = 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Implements realtime scheduling, memory locking and CPU pinning for the
+ * input loop, with a watchdog demoting it if it stops sleeping
+ */
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "event_loop.h"
+
+#define REALTIME_MAX_PRIORITY   98      // The watchdog runs one above
+#define REALTIME_STACK_PREFAULT (256 * 1024)
+#define REALTIME_WATCHDOG_MS    1000
+#define REALTIME_MAX_LOAD       90      // Percent of one CPU
+
+typedef struct {
+    pthread_t target;           // Thread demoted when it busy loops
+    clockid_t target_clock;     // CPU time clock of `target`
+    const event_loop* loop;     // Spinning on purpose is not a busy loop
+    int priority;               // SCHED_FIFO priority restored after demotion
+    uint64_t interval;          // ns between checks
+    unsigned int max_load;      // Percent of `interval` `target` may run
+    int stop_fd;                // eventfd telling the watchdog to exit
+    pthread_t thread;
+    int started;
+    int demoted;                // Set by the watchdog while demoted
+    unsigned long overloads;    // Checks over `max_load`, set by the watchdog
+    unsigned long restores;     // Times the priority was given back
+} realtime_watchdog;
+
+/*
+ * Restricts the calling thread to `cpu`, returns zero on success, and a
+ * negative value on errors
+ */
+int pin_to_cpu(int cpu);
+
+/*
+ * Locks current and future memory into RAM and touches `stack_bytes` of the
+ * calling thread's stack so they are already mapped. Returns zero on success,
+ * and a negative value on errors
+ */
+int lock_memory(size_t stack_bytes);
+
+/*
+ * Runs the calling thread SCHED_FIFO at `priority` (1 - REALTIME_MAX_PRIORITY)
+ * without passing it on to threads or processes it starts. Returns zero on
+ * success, and a negative value on errors
+ */
+int set_realtime_priority(int priority);
+
+/*
+ * Starts a watchdog one priority above `priority` that checks the calling
+ * thread every `interval_ms`, and puts it back to SCHED_OTHER if it used more
+ * than `max_load` percent of a CPU besides the time `loop` spent spinning. The
+ * priority is restored after a check within the limit. Returns zero on
+ * success, and a negative value on errors
+ */
+int start_realtime_watchdog(realtime_watchdog* watchdog, const event_loop* loop,
+    int priority, unsigned int interval_ms, unsigned int max_load);
+
+/*
+ * Stops the watchdog if it was started
+ */
+void stop_realtime_watchdog(realtime_watchdog* watchdog);
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Implements periodic tasks on absolute monotonic deadlines, sharing a single
+ * timerfd in the event loop
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "scheduler.h"
+
+/*
+ * Private helper functions
+ */
+static void arm_scheduler(scheduler* sched)
+{
+    struct itimerspec spec = { 0 };
+    uint64_t next = UINT64_MAX;
+    for (int i = 0; i < sched->count; i++)
+    {
+        if (sched->tasks[i].deadline < next) next = sched->tasks[i].deadline;
+    }
+    if (next == UINT64_MAX)
+    {
+        return;
+    }
+    spec.it_value.tv_sec = next / 1000000000ULL;
+    spec.it_value.tv_nsec = next % 1000000000ULL;
+    timerfd_settime(sched->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+static void run_task(periodic_task* task, uint64_t now)
+{
+    histogram_add(&task->lateness, now - task->deadline);
+    if (task->runs > 0)
+    {
+        int64_t interval = now - task->last_run;
+        histogram_add(&task->jitter, interval > (int64_t)task->period
+            ? interval - task->period : task->period - interval);
+    }
+    task->last_run = now;
+    task->runs++;
+    task->callback(task, now, task->data);
+
+    // Advance on the fixed grid, skipping any periods already lost
+    task->deadline += task->period;
+    if (task->deadline <= now)
+    {
+        uint64_t lost = (now - task->deadline) / task->period + 1;
+        task->missed += lost;
+        task->deadline += lost * task->period;
+    }
+}
+static void scheduler_handler(event_loop* loop, uint64_t value, void* data)
+{
+    scheduler* sched = data;
+    uint64_t expirations;
+    if (read(sched->timer_fd, &expirations, sizeof(expirations)) < 0)
+    {
+        return;
+    }
+    for (int i = 0; i < sched->count; i++)
+    {
+        uint64_t now = monotonic_ns();
+        if (sched->tasks[i].deadline <= now)
+        {
+            run_task(&sched->tasks[i], now);
+        }
+    }
+    arm_scheduler(sched);
+}
+
+/*
+ * Creates a scheduler driven by `loop`, returns NULL on error
+ */
+scheduler* create_scheduler(event_loop* loop)
+{
+    scheduler* sched = malloc(sizeof(scheduler));
+    if (!sched)
+    {
+        return NULL;
+    }
+    sched->loop = loop;
+    sched->count = 0;
+    sched->epoch = monotonic_ns();
+    sched->timer_fd = timerfd_create(
+        CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (sched->timer_fd < 0)
+    {
+        free(sched);
+        return NULL;
+    }
+    if (add_event_fd(loop, sched->timer_fd, EPOLLIN,
+        scheduler_handler, sched) != 0)
+    {
+        close(sched->timer_fd);
+        free(sched);
+        return NULL;
+    }
+    return sched;
+}
+
+/*
+ * Runs `callback` every `period_ms`, on deadlines that are whole periods from
+ * the scheduler's epoch so a late run never shifts later ones. Returns the new
+ * task, or NULL on error
+ */
+periodic_task* add_periodic_task(scheduler* sched, const char* name,
+    unsigned int period_ms, task_callback callback, void* data)
+{
+    periodic_task* task;
+    uint64_t now = monotonic_ns();
+    if (sched->count >= SCHEDULER_MAX_TASKS || period_ms == 0)
+    {
+        return NULL;
+    }
+    task = &sched->tasks[sched->count++];
+    task->name = name;
+    task->period = period_ms * 1000000ULL;
+    task->deadline = sched->epoch
+        + ((now - sched->epoch) / task->period + 1) * task->period;
+    task->last_run = 0;
+    task->runs = 0;
+    task->missed = 0;
+    reset_histogram(&task->lateness);
+    reset_histogram(&task->jitter);
+    task->callback = callback;
+    task->data = data;
+    arm_scheduler(sched);
+    return task;
+}
+
+/*
+ * Writes run counts, lateness and jitter of every task to `out`
+ */
+void print_scheduler_stats(FILE* out, scheduler* sched)
+{
+    char name[64];
+    for (int i = 0; i < sched->count; i++)
+    {
+        periodic_task* task = &sched->tasks[i];
+        fprintf(out, "task %s: period=%llums runs=%llu missed=%llu\n",
+            task->name, (unsigned long long)(task->period / 1000000),
+            (unsigned long long)task->runs, (unsigned long long)task->missed);
+        snprintf(name, sizeof(name), "task %s lateness", task->name);
+        print_histogram(out, name, &task->lateness);
+        snprintf(name, sizeof(name), "task %s jitter", task->name);
+        print_histogram(out, name, &task->jitter);
+    }
+}
+
+/*
+ * Removes the scheduler from its loop and frees memory
+ */
+void close_scheduler(scheduler* sched)
+{
+    remove_event_fd(sched->loop, sched->timer_fd);
+    close(sched->timer_fd);
+    free(sched);
+}
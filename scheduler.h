@@ -0,0 +1,68 @@
+/*
+ * Implements periodic tasks on absolute monotonic deadlines, sharing a single
+ * timerfd in the event loop
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "event_loop.h"
+#include "histogram.h"
+
+#define SCHEDULER_MAX_TASKS 8
+
+typedef struct periodic_task periodic_task;
+
+/*
+ * Called once per period, `now` is the CLOCK_MONOTONIC time in ns it started
+ */
+typedef void (*task_callback)(periodic_task* task, uint64_t now, void* data);
+
+struct periodic_task {
+    const char* name;
+    uint64_t period;            // Period in ns
+    uint64_t deadline;          // Next absolute CLOCK_MONOTONIC deadline in ns
+    uint64_t last_run;          // Start of the previous run in ns
+    uint64_t runs;
+    uint64_t missed;            // Whole periods skipped by overruns
+    histogram lateness;         // Start time minus deadline
+    histogram jitter;           // Start to start interval minus period
+    task_callback callback;
+    void* data;
+};
+
+typedef struct {
+    int timer_fd;
+    event_loop* loop;
+    uint64_t epoch;             // Deadlines are whole periods from this time
+    int count;
+    periodic_task tasks[SCHEDULER_MAX_TASKS];
+} scheduler;
+
+/*
+ * Creates a scheduler driven by `loop`, returns NULL on error
+ */
+scheduler* create_scheduler(event_loop* loop);
+
+/*
+ * Runs `callback` every `period_ms`, on deadlines that are whole periods from
+ * the scheduler's epoch so a late run never shifts later ones. Returns the new
+ * task, or NULL on error
+ */
+periodic_task* add_periodic_task(scheduler* sched, const char* name,
+    unsigned int period_ms, task_callback callback, void* data);
+
+/*
+ * Writes run counts, lateness and jitter of every task to `out`
+ */
+void print_scheduler_stats(FILE* out, scheduler* sched);
+
+/*
+ * Removes the scheduler from its loop and frees memory
+ */
+void close_scheduler(scheduler* sched);
+
+#endif
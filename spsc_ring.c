@@ -0,0 +1,81 @@
+/*
+ * Implements a lock-free ring buffer handing fixed size items from one
+ * producer thread to one consumer thread
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_ring.h"
+
+/*
+ * Allocates room for `capacity` items of `item_size` bytes, `capacity` must be
+ * a power of 2. Returns zero on success, and a negative value on errors
+ */
+int init_spsc_ring(spsc_ring* ring, unsigned int capacity, size_t item_size)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)))
+    {
+        return -1;
+    }
+    ring->items = calloc(capacity, item_size);
+    if (!ring->items)
+    {
+        return -2;
+    }
+    ring->item_size = item_size;
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+    return 0;
+}
+
+/*
+ * Copies `item` in from the producer thread without blocking. Returns zero on
+ * success, and a negative value if the ring is full and the item was dropped
+ */
+int spsc_ring_push(spsc_ring* ring, const void* item)
+{
+    // Indices run freely and wrap, only their difference matters
+    unsigned int head = ring->head;
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail > ring->mask)
+    {
+        // Only the producer counts, others read it for statistics
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    memcpy(ring->items + (head & ring->mask) * ring->item_size, item,
+        ring->item_size);
+    // Publishes the copy before the consumer can see the new head
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Copies the oldest item out to `item` from the consumer thread. Returns 1 if
+ * there was one, and 0 if the ring is empty
+ */
+int spsc_ring_pop(spsc_ring* ring, void* item)
+{
+    unsigned int tail = ring->tail;
+    if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+    memcpy(item, ring->items + (tail & ring->mask) * ring->item_size,
+        ring->item_size);
+    // The slot may be reused once the copy is out
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * Frees the ring once neither thread uses it
+ */
+void free_spsc_ring(spsc_ring* ring)
+{
+    free(ring->items);
+    ring->items = NULL;
+}
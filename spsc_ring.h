@@ -0,0 +1,46 @@
+/*
+ * Implements a lock-free ring buffer handing fixed size items from one
+ * producer thread to one consumer thread
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stddef.h>
+
+#define SPSC_RING_CACHE_LINE 64
+
+typedef struct {
+    size_t item_size;
+    unsigned int mask;          // Capacity minus one, capacity is a power of 2
+    unsigned char* items;
+    // Each side only writes its own index, kept apart to avoid false sharing
+    unsigned int head __attribute__((aligned(SPSC_RING_CACHE_LINE)));
+    unsigned long dropped;      // Pushes that found the ring full
+    unsigned int tail __attribute__((aligned(SPSC_RING_CACHE_LINE)));
+} spsc_ring;
+
+/*
+ * Allocates room for `capacity` items of `item_size` bytes, `capacity` must be
+ * a power of 2. Returns zero on success, and a negative value on errors
+ */
+int init_spsc_ring(spsc_ring* ring, unsigned int capacity, size_t item_size);
+
+/*
+ * Copies `item` in from the producer thread without blocking. Returns zero on
+ * success, and a negative value if the ring is full and the item was dropped
+ */
+int spsc_ring_push(spsc_ring* ring, const void* item);
+
+/*
+ * Copies the oldest item out to `item` from the consumer thread. Returns 1 if
+ * there was one, and 0 if the ring is empty
+ */
+int spsc_ring_pop(spsc_ring* ring, void* item);
+
+/*
+ * Frees the ring once neither thread uses it
+ */
+void free_spsc_ring(spsc_ring* ring);
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * Runs the analog stick driver against a register level simulation of the
+ * ADS1115 in place of the I2C bus, and checks that each axis reads its own
+ * channel and is calibrated, smoothed, deadzoned and thresholded
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "analog_stick.h"
+#include "i2c_bus.h"
+
+#define ADC_ADDR        0x48
+#define ADC_BUS         3
+#define COUNTS_PER_VOLT 8000.0  // 32768 counts over +-4.096 V
+#define CENTER_VOLTS    1.65
+#define FULL_VOLTS      3.3
+
+// Registers and inputs of the simulated ADC
+typedef struct {
+    uint8_t pointer;
+    uint16_t config;
+    int16_t conversion;
+    int converted;              // Channel converting, -1 if none
+    double volts[4];            // AIN0 - AIN3
+    int fail_reads;             // Conversion reads left to fail
+    unsigned long bad_configs;
+    unsigned long stale_reads;  // Conversion read twice or never started
+} ads1115;
+
+static ads1115 adc;
+static int failures = 0;
+
+/*
+ * The I2C bus, with the ADC as the only device on it
+ */
+int open_i2c_device(const char* bus, long addr)
+{
+    return addr == ADC_ADDR ? ADC_BUS : -1;
+}
+void close_i2c_device(int bus) { }
+int i2c_transfer(int bus, uint16_t addr, const uint8_t* out, int write_len,
+    uint8_t* in, int read_len)
+{
+    uint16_t value;
+    if (bus != ADC_BUS || addr != ADC_ADDR || write_len < 1)
+    {
+        return -1;
+    }
+    adc.pointer = out[0] & 0x03;
+    if (write_len == 3 && adc.pointer == 0x01)
+    {
+        value = (out[1] << 8) | out[2];
+        // Single ended AIN0 - AIN3, +-4.096 V, single shot, 860 samples/s,
+        // comparator off
+        if ((value & 0x4000) == 0 || ((value >> 9) & 0x7) != 1
+            || (value & 0x0100) == 0 || ((value >> 5) & 0x7) != 7
+            || (value & 0x3) != 3)
+        {
+            adc.bad_configs++;
+        }
+        adc.config = value & 0x7FFF;
+        // The conversion finishes before the driver's next step reads it
+        if (value & 0x8000) adc.converted = (value >> 12) & 0x3;
+    }
+    else if (write_len != 1)
+    {
+        return -1;
+    }
+    if (read_len == 0)
+    {
+        return 0;
+    }
+    if (read_len != 2)
+    {
+        return -1;
+    }
+    if (adc.pointer == 0x00 && adc.fail_reads > 0)
+    {
+        adc.fail_reads--;
+        return -1;
+    }
+    if (adc.pointer == 0x00 && adc.converted < 0)
+    {
+        adc.stale_reads++;
+    }
+    else if (adc.pointer == 0x00)
+    {
+        double counts = adc.volts[adc.converted] * COUNTS_PER_VOLT;
+        adc.conversion = (int16_t)lround(counts > 32767 ? 32767 : counts);
+    }
+    value = adc.pointer == 0x00 ? (uint16_t)adc.conversion : adc.config;
+    if (adc.pointer == 0x00) adc.converted = -1;
+    // Most significant byte first
+    in[0] = value >> 8;
+    in[1] = value & 0xFF;
+    return 0;
+}
+
+/*
+ * Private helper functions
+ */
+static void expect(int ok, const char* what)
+{
+    if (!ok)
+    {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static void open_stick(analog_stick* stick, const char* smoothing)
+{
+    memset(&adc, 0, sizeof(adc));
+    adc.converted = -1;
+    adc.volts[0] = CENTER_VOLTS;
+    adc.volts[1] = CENTER_VOLTS;
+    init_analog_stick(stick);
+    configure_analog_stick(stick, "rate_hz", "100");
+    configure_analog_stick(stick, "smoothing", smoothing);
+    expect(open_analog_stick(stick, ADC_ADDR, "/dev/i2c-1") == 0,
+        "ADC opens");
+}
+
+/*
+ * Steps both axes once, returns the number of events and leaves the X and Y
+ * values reported in them, or `unset` for axes without events
+ */
+static int step_both(analog_stick* stick, int32_t* x, int32_t* y,
+    int32_t unset)
+{
+    int events = 0;
+    *x = unset;
+    *y = unset;
+    for (int i = 0; i < ANALOG_STICK_AXES; i++)
+    {
+        device_event event;
+        if (analog_stick_step(stick, &event) != 1)
+        {
+            continue;
+        }
+        if (event.type == EV_ABS && event.code == ABS_X) *x = event.value;
+        if (event.type == EV_ABS && event.code == ABS_Y) *y = event.value;
+        events++;
+    }
+    return events;
+}
+
+static void check_axes(void)
+{
+    analog_stick stick;
+    int32_t x, y;
+    open_stick(&stick, "0");
+    expect(step_both(&stick, &x, &y, 1) == 0, "rest reports nothing");
+
+    adc.volts[0] = FULL_VOLTS;
+    step_both(&stick, &x, &y, 1);
+    expect(x == ANALOG_STICK_MAX && y == 1, "AIN0 drives ABS_X alone");
+    adc.volts[1] = 0;
+    step_both(&stick, &x, &y, 1);
+    expect(x == 1 && y == -ANALOG_STICK_MAX, "AIN1 drives ABS_Y alone");
+
+    // Half way out, then a millivolt of noise
+    adc.volts[0] = CENTER_VOLTS + FULL_VOLTS / 4;
+    step_both(&stick, &x, &y, 1);
+    expect(x > 0 && x < ANALOG_STICK_MAX, "half deflection is in range");
+    adc.volts[0] += 0.001;
+    step_both(&stick, &x, &y, 1);
+    expect(x == 1, "moves under the threshold are not reported");
+
+    // Inside the deadzone is rest, which is always reported
+    adc.volts[0] = CENTER_VOLTS + 0.05;
+    step_both(&stick, &x, &y, 1);
+    expect(x == 0, "deadzone reports rest");
+
+    expect(stick.errors == 0 && stick.conversions == 12,
+        "every step converts");
+    expect(adc.bad_configs == 0, "conversions use the expected config");
+    expect(adc.stale_reads == 0, "every read follows its own conversion");
+    close_analog_stick(&stick);
+}
+
+static void check_smoothing(void)
+{
+    analog_stick stick;
+    int32_t x, y, last = 0;
+    int steps = 0, rising = 1;
+    open_stick(&stick, "0.5");
+    step_both(&stick, &x, &y, 0);
+    adc.volts[0] = FULL_VOLTS;
+    while (last != ANALOG_STICK_MAX && steps++ < 50)
+    {
+        if (step_both(&stick, &x, &y, last) == 0) continue;
+        if (x <= last) rising = 0;
+        last = x;
+    }
+    expect(rising && last == ANALOG_STICK_MAX,
+        "smoothed axis rises to full deflection");
+    expect(steps > 2, "smoothing slows a step change");
+    close_analog_stick(&stick);
+}
+
+static void check_calibration(void)
+{
+    analog_stick stick;
+    int32_t x, y;
+    open_stick(&stick, "0");
+    expect(configure_analog_stick(&stick, "x_calibration",
+        "26400 13200 0") == 0, "inverted calibration is accepted");
+    adc.volts[0] = FULL_VOLTS;
+    step_both(&stick, &x, &y, 1);
+    expect(x == -ANALOG_STICK_MAX, "inverted axis reports the minimum");
+    expect(configure_analog_stick(&stick, "y_calibration", "1 2") != 0,
+        "incomplete calibration is refused");
+    close_analog_stick(&stick);
+}
+
+static void check_errors(void)
+{
+    analog_stick stick;
+    device_event event;
+    int32_t x, y;
+    open_stick(&stick, "0");
+    adc.fail_reads = 1;
+    expect(analog_stick_step(&stick, &event) < 0, "failed read is an error");
+    expect(stick.errors == 1, "failed read is counted");
+    // The next conversion still started, on the other axis
+    adc.volts[0] = FULL_VOLTS;
+    step_both(&stick, &x, &y, 1);
+    expect(x == ANALOG_STICK_MAX, "stick recovers after a failed read");
+    close_analog_stick(&stick);
+}
+
+int main(void)
+{
+    check_axes();
+    check_smoothing();
+    check_calibration();
+    check_errors();
+    printf("analog_stick_check: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Measures the cost of turning a button transition into key events with the
+ * keymap, axes included, against a scan of every button for its keys as the
+ * hard coded dispatch did, and checks that both send the same keys
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "keymap.h"
+
+#define ROUNDS      200000
+#define ALL_BUTTONS 0xFF3F      // Bits 6 and 7 are not wired
+
+typedef struct {
+    const char* name;
+    arcade_buttons pressed;     // Buttons that change on every transition
+} transition;
+
+static const transition TRANSITIONS[] = {
+    { "one button", BUTTON_1A },
+    { "two buttons", BUTTON_1C | PAD_UP },
+    { "stick diagonal", STICK_UP | STICK_LEFT },
+    { "every button", ALL_BUTTONS },
+};
+
+// Keeps the compiler from dropping the dispatch being timed
+static volatile int sink;
+
+/*
+ * Private helper functions
+ */
+static uint64_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Key events for every button, tested one by one in bit order
+static int scan_events(const keymap* map, arcade_buttons last,
+    arcade_buttons curr, device_event* events)
+{
+    int count = 0;
+    for (int index = 0; index < KEYMAP_BUTTONS; index++)
+    {
+        const keymap_entry* entry = &map->buttons[index];
+        if (!(((last ^ curr) >> index) & 1))
+        {
+            continue;
+        }
+        for (unsigned int i = 0; i < entry->count; i++)
+        {
+            if (entry->outputs[i].type != EV_KEY) continue;
+            events[count].type = EV_KEY;
+            events[count].code = entry->outputs[i].code;
+            events[count].value = !((curr >> index) & 1);
+            count++;
+        }
+    }
+    return count;
+}
+
+// Both dispatches send the same key events, in the same order
+static int same_keys(const keymap* map, arcade_buttons last,
+    arcade_buttons curr)
+{
+    device_event table[KEYMAP_MAX_EVENTS], scan[KEYMAP_MAX_EVENTS];
+    int count = keymap_events(map, last, curr, table);
+    int keys = scan_events(map, last, curr, scan);
+    for (int i = 0; i < keys; i++)
+    {
+        if (i >= count || table[i].type != EV_KEY
+            || table[i].code != scan[i].code
+            || table[i].value != scan[i].value)
+        {
+            return 0;
+        }
+    }
+    return keys == count || table[keys].type != EV_KEY;
+}
+
+// Nanoseconds per dispatch, press and release alternating
+static double time_dispatch(const keymap* map, arcade_buttons pressed,
+    int table)
+{
+    device_event events[KEYMAP_MAX_EVENTS];
+    arcade_buttons released = 0xFFFF, held = 0xFFFF & ~pressed;
+    uint64_t start = now();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        if (table)
+        {
+            sink = keymap_events(map, released, held, events);
+            sink = keymap_events(map, held, released, events);
+        }
+        else
+        {
+            sink = scan_events(map, released, held, events);
+            sink = scan_events(map, held, released, events);
+        }
+    }
+    return (double)(now() - start) / (2.0 * ROUNDS);
+}
+
+int main(void)
+{
+    const int count = sizeof(TRANSITIONS) / sizeof(TRANSITIONS[0]);
+    int failures = 0;
+    for (int layout = 0; layout < KEYMAP_LAYOUTS; layout++)
+    {
+        keymap map;
+        default_keymap(&map, layout);
+        for (int i = 0; i < count; i++)
+        {
+            arcade_buttons held = 0xFFFF & ~TRANSITIONS[i].pressed;
+            if (!same_keys(&map, 0xFFFF, held)
+                || !same_keys(&map, held, 0xFFFF))
+            {
+                printf("FAIL: %s %s sends other keys than a scan\n",
+                    keymap_layout_name(layout), TRANSITIONS[i].name);
+                failures++;
+            }
+        }
+    }
+
+    // Timings only inform, machines differ too much to fail on them
+    for (int layout = 0; layout < KEYMAP_LAYOUTS; layout++)
+    {
+        keymap map;
+        default_keymap(&map, layout);
+        for (int i = 0; i < count; i++)
+        {
+            printf("%-8s %-15s keymap %6.1f ns  scan %6.1f ns\n",
+                keymap_layout_name(layout), TRANSITIONS[i].name,
+                time_dispatch(&map, TRANSITIONS[i].pressed, 1),
+                time_dispatch(&map, TRANSITIONS[i].pressed, 0));
+        }
+    }
+    printf("dispatch_bench: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
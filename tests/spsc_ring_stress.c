@@ -0,0 +1,129 @@
+/*
+ * Stress test of the SPSC ring between two threads. Checks that items arrive
+ * once and in order, and shows that pushes from the input side never wait on
+ * a stalled consumer, as when the battery thread is stuck on a slow read
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "spsc_ring.h"
+#include "histogram.h"
+
+#define LOSSLESS_ITEMS  2000000
+#define STALL_ITEMS     20000
+#define STALL_EVERY     1000        // Items between consumer stalls
+#define STALL_MS        20          // Consumer stall, a slow gauge read
+#define PUSH_PACE_US    20          // Time between pushes while stalling
+#define RING_CAPACITY   64
+
+typedef struct {
+    spsc_ring ring;
+    unsigned long items;
+    int lossy;                  // Producer drops instead of retrying
+    int stall;                  // Consumer stalls every STALL_EVERY items
+    volatile int done;
+    unsigned long received;
+    unsigned long errors;
+    histogram push_time;
+} stress_run;
+
+/*
+ * Private helper functions
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void sleep_us(unsigned long us)
+{
+    struct timespec t = { us / 1000000, (us % 1000000) * 1000 };
+    nanosleep(&t, NULL);
+}
+
+static void* consumer_main(void* data)
+{
+    stress_run* run = data;
+    uint64_t item, next = 0;
+    for (;;)
+    {
+        if (!spsc_ring_pop(&run->ring, &item))
+        {
+            if (__atomic_load_n(&run->done, __ATOMIC_ACQUIRE)
+                && !spsc_ring_pop(&run->ring, &item))
+            {
+                break;
+            }
+            // A single CPU would otherwise spin out its whole time slice
+            sched_yield();
+            continue;
+        }
+        // Lossy runs may skip items, but never repeat or reorder them
+        if (item < next || (!run->lossy && item != next))
+        {
+            run->errors++;
+        }
+        next = item + 1;
+        run->received++;
+        if (run->stall && run->received % STALL_EVERY == 0)
+        {
+            sleep_us(STALL_MS * 1000);
+        }
+    }
+    return NULL;
+}
+
+static int run_stress(stress_run* run, const char* name)
+{
+    pthread_t consumer;
+    unsigned long dropped;
+    reset_histogram(&run->push_time);
+    if (init_spsc_ring(&run->ring, RING_CAPACITY, sizeof(uint64_t)) != 0
+        || pthread_create(&consumer, NULL, consumer_main, run) != 0)
+    {
+        fprintf(stderr, "Error: cannot start %s run\n", name);
+        return -1;
+    }
+
+    for (uint64_t item = 0; item < run->items; item++)
+    {
+        uint64_t start = now_ns();
+        int ret = spsc_ring_push(&run->ring, &item);
+        histogram_add(&run->push_time, now_ns() - start);
+        if (run->lossy)
+        {
+            sleep_us(PUSH_PACE_US);
+        }
+        else if (ret != 0)
+        {
+            sched_yield();
+            item--;
+        }
+    }
+    __atomic_store_n(&run->done, 1, __ATOMIC_RELEASE);
+    pthread_join(consumer, NULL);
+
+    dropped = run->lossy ? run->ring.dropped : 0;
+    printf("%s: pushed=%lu received=%lu dropped=%lu errors=%lu\n", name,
+        run->items, run->received, dropped, run->errors);
+    print_histogram(stdout, "  push", &run->push_time);
+    free_spsc_ring(&run->ring);
+    return run->errors || run->received + dropped != run->items ? -1 : 0;
+}
+
+int main(void)
+{
+    stress_run lossless = { .items = LOSSLESS_ITEMS };
+    stress_run stalled = { .items = STALL_ITEMS, .lossy = 1, .stall = 1 };
+    int failed = 0;
+    failed |= run_stress(&lossless, "lossless");
+    failed |= run_stress(&stalled, "stalled consumer");
+    printf("spsc_ring_stress: %s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,227 @@
+/*
+ * Replays a simulated MCP23017 whose interrupt stays asserted through the I2C
+ * transport, with a simulated interrupt line in place of libgpiod, and checks
+ * that the watchdog clears it only when nothing serviced it, counts each
+ * recovery, and tells failed checks apart
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arcade_buttons.h"
+#include "i2c_bus.h"
+
+#define BONNET_ADDR     0x26
+#define INT_PIN         17
+#define REG_IODIRA      0x00
+#define REG_INTFA       0x0E
+
+// Level of the simulated open drain line, and whether reading it fails
+static int line_low = 0;
+static int line_error = 0;
+static int failures = 0;
+
+/*
+ * Simulated interrupt line, the only libgpiod call the watchdog makes. The
+ * rest only set up lines and are never reached here
+ */
+enum gpiod_line_value gpiod_line_request_get_value(
+    struct gpiod_line_request* request, unsigned int offset)
+{
+    if (line_error) return GPIOD_LINE_VALUE_ERROR;
+    return line_low ? GPIOD_LINE_VALUE_INACTIVE : GPIOD_LINE_VALUE_ACTIVE;
+}
+struct gpiod_chip* gpiod_chip_open(const char* path) { return NULL; }
+void gpiod_chip_close(struct gpiod_chip* chip) { }
+struct gpiod_line_request* gpiod_chip_request_lines(struct gpiod_chip* chip,
+    struct gpiod_request_config* req, struct gpiod_line_config* line)
+{
+    return NULL;
+}
+struct gpiod_line_settings* gpiod_line_settings_new(void) { return NULL; }
+void gpiod_line_settings_free(struct gpiod_line_settings* s) { }
+int gpiod_line_settings_set_direction(struct gpiod_line_settings* s,
+    enum gpiod_line_direction d)
+{
+    return -1;
+}
+int gpiod_line_settings_set_edge_detection(struct gpiod_line_settings* s,
+    enum gpiod_line_edge e)
+{
+    return -1;
+}
+int gpiod_line_settings_set_event_clock(struct gpiod_line_settings* s,
+    enum gpiod_line_clock c)
+{
+    return -1;
+}
+struct gpiod_line_config* gpiod_line_config_new(void) { return NULL; }
+void gpiod_line_config_free(struct gpiod_line_config* c) { }
+int gpiod_line_config_add_line_settings(struct gpiod_line_config* c,
+    const unsigned int* offsets, size_t count, struct gpiod_line_settings* s)
+{
+    return -1;
+}
+struct gpiod_request_config* gpiod_request_config_new(void) { return NULL; }
+void gpiod_request_config_free(struct gpiod_request_config* c) { }
+void gpiod_request_config_set_consumer(struct gpiod_request_config* c,
+    const char* name)
+{
+}
+void gpiod_line_request_release(struct gpiod_line_request* r) { }
+int gpiod_line_request_get_fd(struct gpiod_line_request* r) { return -1; }
+int gpiod_line_request_wait_edge_events(struct gpiod_line_request* r,
+    int64_t timeout)
+{
+    return -1;
+}
+int gpiod_line_request_read_edge_events(struct gpiod_line_request* r,
+    struct gpiod_edge_event_buffer* b, size_t max)
+{
+    return -1;
+}
+struct gpiod_edge_event_buffer* gpiod_edge_event_buffer_new(size_t size)
+{
+    return NULL;
+}
+void gpiod_edge_event_buffer_free(struct gpiod_edge_event_buffer* b) { }
+struct gpiod_edge_event* gpiod_edge_event_buffer_get_event(
+    struct gpiod_edge_event_buffer* b, unsigned long index)
+{
+    return NULL;
+}
+uint64_t gpiod_edge_event_get_timestamp_ns(struct gpiod_edge_event* e)
+{
+    return 0;
+}
+
+/*
+ * Private helper functions
+ */
+static void add_read(FILE* trace, uint64_t time, uint8_t reg,
+    const uint8_t* response, int len, int result)
+{
+    i2c_trace_record record = { 0 };
+    record.time = time;
+    record.addr = BONNET_ADDR;
+    record.write_len = 1;
+    record.read_len = len;
+    record.result = result;
+    record.data[0] = reg;
+    memcpy(record.data + 1, response, len);
+    fwrite(&record, sizeof(record), 1, trace);
+}
+
+// INTFA/B, INTCAPA/B and GPIOA/B as one burst read returns them
+static void add_burst(FILE* trace, uint64_t time, uint16_t flags,
+    uint16_t captured, uint16_t state, int result)
+{
+    uint8_t burst[6] = { flags & 0xFF, flags >> 8, captured & 0xFF,
+        captured >> 8, state & 0xFF, state >> 8 };
+    add_read(trace, time, REG_INTFA, burst, 6, result);
+}
+
+static int write_trace(const char* path)
+{
+    uint32_t magic = I2C_TRACE_MAGIC;
+    uint16_t version = I2C_TRACE_VERSION, reserved = 0;
+    uint8_t config[14] = { 0 };
+    FILE* trace = fopen(path, "wb");
+    if (!trace)
+    {
+        return -1;
+    }
+    fwrite(&magic, sizeof(magic), 1, trace);
+    fwrite(&version, sizeof(version), 1, trace);
+    fwrite(&reserved, sizeof(reserved), 1, trace);
+    add_read(trace, 1000, REG_IODIRA, config, 14, 0);
+    // Clearing read at setup, then a serviced tap of BUTTON_1B
+    add_burst(trace, 2000, 0x0000, 0xFFFF, 0xFFFF, 0);
+    add_burst(trace, 3000, 0x0002, 0xFFFD, 0xFFFF, 0);
+    // Recovery of a missed BUTTON_1A press, then INTF stuck set
+    add_burst(trace, 4000, 0x0001, 0xFFFE, 0xFFFE, 0);
+    add_burst(trace, 5000, 0x0001, 0xFFFE, 0xFFFE, 0);
+    // The bus fails during a recovery
+    add_burst(trace, 6000, 0, 0, 0, -1);
+    return fclose(trace) == 0 ? 0 : -1;
+}
+
+static void expect(int ok, const char* what)
+{
+    if (!ok)
+    {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// One watchdog period, long enough for the clock to move on
+static int check(arcade_bonnet* bonnet)
+{
+    usleep(1000);
+    return recover_button_interrupt(bonnet);
+}
+
+int main(void)
+{
+    char path[] = "/tmp/stuck_interrupt_XXXXXX";
+    arcade_bonnet* bonnet;
+    int fd = mkstemp(path);
+    if (fd < 0 || write_trace(path) != 0
+        || replay_i2c(path, I2C_REPLAY_FAST) != 0)
+    {
+        fprintf(stderr, "Error: cannot replay %s\n", path);
+        return 1;
+    }
+    close(fd);
+    unlink(path);
+
+    bonnet = configure_arcade_bonnet(BONNET_ADDR, "/dev/i2c-1");
+    if (!bonnet)
+    {
+        fprintf(stderr, "Error: cannot set up the simulated expander\n");
+        return 1;
+    }
+    expect(bonnet->state == 0xFFFF, "setup reads all buttons released");
+    // Stands in for configure_button_interrupt
+    bonnet->int_pin = (struct gpiod_line_request*)bonnet;
+    bonnet->int_offset = INT_PIN;
+    bonnet->int_low = 0;
+    bonnet->int_checked = 0;
+    bonnet->recoveries = 0;
+
+    expect(check(bonnet) == 0, "idle line needs no recovery");
+    // Asserted, but the input loop reads the expander before the next check
+    line_low = 1;
+    expect(check(bonnet) == 0, "first sight of a low line waits");
+    expect(read_buttons_pressed(bonnet) == 1, "serviced tap is read");
+    expect(check(bonnet) == 0, "serviced interrupt is not recovered");
+
+    // Still low a period after that read, a missed edge nothing else reads
+    expect(check(bonnet) == 1, "unserviced line is recovered");
+    expect(bonnet->state == 0xFFFE, "recovery read the missed press");
+    expect(bonnet->recoveries == 1, "recovery is counted");
+
+    // INTF stays set and the line low, every other check recovers again
+    expect(check(bonnet) == 0, "line seen low again after recovery");
+    expect(check(bonnet) == 1, "stuck line is recovered again");
+    expect(bonnet->recoveries == 2, "each recovery is counted");
+
+    expect(check(bonnet) == 0, "line seen low before the bus fails");
+    expect(check(bonnet) == -2, "failed recovery read is an error");
+    expect(bonnet->recoveries == 2, "failed recovery is not counted");
+
+    line_error = 1;
+    expect(check(bonnet) == -1, "unreadable line is an error");
+    line_error = 0;
+    line_low = 0;
+    expect(check(bonnet) == 0, "released line needs no recovery");
+
+    bonnet->int_pin = NULL;
+    close_arcade_bonnet(bonnet);
+    close_i2c_trace();
+    printf("stuck_interrupt_check: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
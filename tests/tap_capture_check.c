@@ -0,0 +1,246 @@
+/*
+ * Fires sub-millisecond taps at a simulated MCP23017 between reads, replays
+ * its registers through the I2C transport and checks that the reads rebuild
+ * every press and release in order, and that the debouncer keeps them
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arcade_buttons.h"
+#include "debounce.h"
+#include "i2c_bus.h"
+
+#define BONNET_ADDR     0x26
+#define REG_IODIRA      0x00
+#define REG_INTFA       0x0E
+#define US              1000ULL
+#define MS              1000000ULL
+#define WINDOW_MS       5
+#define START           (1000 * MS) // Monotonic time is never near zero
+
+// Register level model of the expander, recorded as the reads see it
+typedef struct {
+    FILE* trace;
+    uint16_t gpio;
+    uint16_t intf;
+    uint16_t intcap;
+} expander;
+
+static int failures = 0;
+
+/*
+ * Private helper functions
+ */
+static void add_read(FILE* trace, uint64_t time, uint8_t reg,
+    const uint8_t* response, int len)
+{
+    i2c_trace_record record = { 0 };
+    record.time = time;
+    record.addr = BONNET_ADDR;
+    record.write_len = 1;
+    record.read_len = len;
+    record.data[0] = reg;
+    memcpy(record.data + 1, response, len);
+    fwrite(&record, sizeof(record), 1, trace);
+}
+
+// The first change after a read latches INTF and the port into INTCAP
+static void set_button(expander* sim, arcade_buttons button, int pressed)
+{
+    uint16_t gpio = pressed ? sim->gpio & ~button : sim->gpio | button;
+    if (gpio != sim->gpio && !sim->intf)
+    {
+        sim->intf = gpio ^ sim->gpio;
+        sim->intcap = gpio;
+    }
+    sim->gpio = gpio;
+}
+
+// INTFA/B, INTCAPA/B and GPIOA/B in one burst, reading GPIO clears INTF
+static void read_expander(expander* sim, uint64_t time)
+{
+    uint8_t burst[6] = { sim->intf & 0xFF, sim->intf >> 8,
+        sim->intcap & 0xFF, sim->intcap >> 8, sim->gpio & 0xFF,
+        sim->gpio >> 8 };
+    add_read(sim->trace, time, REG_INTFA, burst, 6);
+    sim->intf = 0;
+}
+
+/*
+ * What happens on the buttons, with reads every millisecond. The bonnet side
+ * in main expects the same reads in the same order
+ */
+static int write_trace(const char* path)
+{
+    uint32_t magic = I2C_TRACE_MAGIC;
+    uint16_t version = I2C_TRACE_VERSION, reserved = 0;
+    uint8_t config[14] = { 0 };
+    expander sim = { fopen(path, "wb"), 0xFFFF, 0, 0xFFFF };
+    if (!sim.trace)
+    {
+        return -1;
+    }
+    fwrite(&magic, sizeof(magic), 1, sim.trace);
+    fwrite(&version, sizeof(version), 1, sim.trace);
+    fwrite(&reserved, sizeof(reserved), 1, sim.trace);
+    add_read(sim.trace, 0, REG_IODIRA, config, 14);
+    read_expander(&sim, 0);
+
+    // A 300 us tap of 1A between two reads
+    set_button(&sim, BUTTON_1A, 1);
+    set_button(&sim, BUTTON_1A, 0);
+    read_expander(&sim, 1 * MS);
+
+    // 1A held across a read, then released
+    set_button(&sim, BUTTON_1A, 1);
+    read_expander(&sim, 2 * MS);
+    set_button(&sim, BUTTON_1A, 0);
+    read_expander(&sim, 3 * MS);
+
+    // A 500 us tap of 1B while 1A is held
+    set_button(&sim, BUTTON_1A, 1);
+    read_expander(&sim, 4 * MS);
+    set_button(&sim, BUTTON_1B, 1);
+    set_button(&sim, BUTTON_1B, 0);
+    read_expander(&sim, 5 * MS);
+    set_button(&sim, BUTTON_1A, 0);
+    read_expander(&sim, 6 * MS);
+
+    // A press of 1B that bounces within 100 us, then nothing
+    set_button(&sim, BUTTON_1B, 1);
+    set_button(&sim, BUTTON_1B, 0);
+    set_button(&sim, BUTTON_1B, 1);
+    read_expander(&sim, 7 * MS);
+    set_button(&sim, BUTTON_1B, 0);
+    read_expander(&sim, 8 * MS);
+    read_expander(&sim, 9 * MS);
+    return fclose(sim.trace) == 0 ? 0 : -1;
+}
+
+static void expect(int ok, const char* what)
+{
+    if (!ok)
+    {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// Reads the expander and checks the states it rebuilds since `last`
+static void expect_sequence(arcade_bonnet* bonnet, arcade_buttons* last,
+    const char* what, int count, arcade_buttons first, arcade_buttons second)
+{
+    arcade_buttons states[2];
+    int ret = read_buttons_pressed(bonnet), got = 0;
+    if (ret > 0)
+    {
+        got = button_state_sequence(bonnet, *last, states);
+    }
+    if (ret < 0 || got != count || (count > 0 && states[0] != first)
+        || (count > 1 && states[1] != second))
+    {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+    if (got > 0) *last = states[got - 1];
+}
+
+/*
+ * Feeds `count` raw states at their times to a debouncer, then once more at
+ * each deadline, and returns how many debounced edges came out
+ */
+static int debounced_edges(debouncer* deb, const arcade_buttons* raw,
+    const uint64_t* time, int count)
+{
+    arcade_buttons state = deb->state;
+    int edges = 0;
+    uint64_t due;
+    for (int i = 0; i < count; i++)
+    {
+        // Deadlines passing before the next raw state fire first
+        while ((due = debounce_deadline(deb)) && due <= time[i])
+        {
+            edges += __builtin_popcount(
+                (debounce_buttons(deb, deb->raw, due) ^ state) & 0xFFFF);
+            state = deb->state;
+        }
+        edges += __builtin_popcount(
+            (debounce_buttons(deb, raw[i], time[i]) ^ state) & 0xFFFF);
+        state = deb->state;
+    }
+    while ((due = debounce_deadline(deb)))
+    {
+        edges += __builtin_popcount(
+            (debounce_buttons(deb, deb->raw, due) ^ state) & 0xFFFF);
+        state = deb->state;
+    }
+    return edges;
+}
+
+static void check_debounce(debounce_mode mode, const char* name)
+{
+    // The rebuilt tap, captured state at the edge and current at the read
+    const arcade_buttons tap[] = { 0xFFFE, 0xFFFF };
+    const uint64_t tap_time[] = { START + 100 * US, START + 400 * US };
+    // A press bouncing for 100 us, released 8 ms later
+    const arcade_buttons bounce[] = { 0xFFFE, 0xFFFF, 0xFFFE, 0xFFFF };
+    const uint64_t bounce_time[] = { START, START + 50 * US,
+        START + 100 * US, START + 8 * MS };
+    debouncer deb;
+    char what[64];
+
+    init_debouncer(&deb, mode, WINDOW_MS, 0xFFFF);
+    snprintf(what, sizeof(what), "%s keeps a 300 us tap", name);
+    expect(debounced_edges(&deb, tap, tap_time, 2) == 2, what);
+    expect(deb.state == 0xFFFF, what);
+
+    init_debouncer(&deb, mode, WINDOW_MS, 0xFFFF);
+    snprintf(what, sizeof(what), "%s emits a bouncing press once", name);
+    expect(debounced_edges(&deb, bounce, bounce_time, 4) == 2, what);
+    expect(deb.state == 0xFFFF && deb.bounces[0] == 1, what);
+}
+
+int main(void)
+{
+    char path[] = "/tmp/tap_capture_XXXXXX";
+    arcade_buttons last = 0xFFFF;
+    arcade_bonnet* bonnet;
+    int fd = mkstemp(path);
+    if (fd < 0 || write_trace(path) != 0
+        || replay_i2c(path, I2C_REPLAY_FAST) != 0)
+    {
+        fprintf(stderr, "Error: cannot replay %s\n", path);
+        return 1;
+    }
+    close(fd);
+    unlink(path);
+
+    bonnet = configure_arcade_bonnet(BONNET_ADDR, "/dev/i2c-1");
+    if (!bonnet)
+    {
+        fprintf(stderr, "Error: cannot set up the simulated expander\n");
+        return 1;
+    }
+    expect_sequence(bonnet, &last, "tap between reads is press, release",
+        2, 0xFFFE, 0xFFFF);
+    expect_sequence(bonnet, &last, "held press is read once", 1, 0xFFFE, 0);
+    expect_sequence(bonnet, &last, "release is read once", 1, 0xFFFF, 0);
+    expect_sequence(bonnet, &last, "second press is read", 1, 0xFFFE, 0);
+    expect_sequence(bonnet, &last, "tap during a hold is press, release",
+        2, 0xFFFC, 0xFFFE);
+    expect_sequence(bonnet, &last, "release after the tap", 1, 0xFFFF, 0);
+    expect_sequence(bonnet, &last, "bouncing press is one press",
+        1, 0xFFFD, 0);
+    expect_sequence(bonnet, &last, "release after bounces", 1, 0xFFFF, 0);
+    expect_sequence(bonnet, &last, "idle read has no states", 0, 0, 0);
+    close_arcade_bonnet(bonnet);
+    close_i2c_trace();
+
+    check_debounce(DEBOUNCE_EAGER, "eager debounce");
+    check_debounce(DEBOUNCE_VERIFY, "verify debounce");
+    printf("tap_capture_check: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
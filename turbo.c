@@ -0,0 +1,194 @@
+/*
+ * Implements per button turbo, toggling held buttons from a timer wheel
+ */
+
+#include <string.h>
+
+#include "turbo.h"
+#include "config.h"
+
+/*
+ * Private helper functions
+ */
+static uint64_t wheel_slot(uint64_t time)
+{
+    return time / TURBO_TICK;
+}
+
+static void schedule_toggle(turbo_engine* turbo, int index, uint64_t due)
+{
+    turbo->next[index] = due;
+    turbo->wheel[wheel_slot(due) & (TURBO_WHEEL_SLOTS - 1)] |= 1 << index;
+}
+
+static void cancel_toggle(turbo_engine* turbo, int index)
+{
+    uint64_t slot = wheel_slot(turbo->next[index]);
+    turbo->wheel[slot & (TURBO_WHEEL_SLOTS - 1)] &= ~(1 << index);
+}
+
+/*
+ * Sets up `turbo` without any turbo buttons
+ */
+void init_turbo(turbo_engine* turbo)
+{
+    memset(turbo, 0, sizeof(turbo_engine));
+    turbo->input = 0xFFFF;
+    reset_histogram(&turbo->jitter);
+}
+
+/*
+ * Enables turbo on the button called `button` with `value` giving the rate in
+ * Hz and optionally the percentage of each cycle spent pressed ("15" or
+ * "15 30"), or "off". Returns zero on success, and a negative value on an
+ * unknown button or invalid value
+ */
+int configure_turbo(turbo_engine* turbo, const char* button,
+    const char* value)
+{
+    char buf[CONFIG_LINE_LEN], *tokens[2];
+    unsigned int rate, duty = 50;
+    int index = keymap_button_index(button), count;
+    if (index < 0)
+    {
+        return -1;
+    }
+
+    strncpy(buf, value, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    count = split_config_value(buf, tokens, 2);
+    if (count == 1 && strcmp(tokens[0], "off") == 0)
+    {
+        turbo->buttons &= ~(1 << index);
+        return 0;
+    }
+    if (count <= 0 || parse_config_uint(tokens[0], &rate) != 0
+        || (count == 2 && parse_config_uint(tokens[1], &duty) != 0)
+        || rate == 0 || rate > TURBO_MAX_RATE || duty == 0 || duty >= 100)
+    {
+        return -2;
+    }
+    turbo->period[index] = 1000000000ULL / rate;
+    turbo->on_time[index] = turbo->period[index] * duty / 100;
+    turbo->buttons |= 1 << index;
+    return 0;
+}
+
+/*
+ * Feeds `state` at `now` (CLOCK_MONOTONIC ns) and returns it with held turbo
+ * buttons in their off phase released. New presses start pressed
+ */
+arcade_buttons turbo_update(turbo_engine* turbo, arcade_buttons state,
+    uint64_t now)
+{
+    // Inputs are pulled up, a cleared bit is a pressed button
+    uint16_t held = ~state & turbo->buttons;
+    uint16_t pressed = held & ~turbo->held, released = turbo->held & ~held;
+    // An idle wheel restarts from the current slot
+    if (!turbo->held) turbo->cursor = wheel_slot(now);
+    turbo->input = state;
+    turbo->held = held;
+
+    for (; released; released &= released - 1)
+    {
+        int index = __builtin_ctz(released);
+        cancel_toggle(turbo, index);
+        turbo->off &= ~(1 << index);
+    }
+    for (; pressed; pressed &= pressed - 1)
+    {
+        int index = __builtin_ctz(pressed);
+        schedule_toggle(turbo, index, now + turbo->on_time[index]);
+    }
+    return state | turbo->off;
+}
+
+/*
+ * Toggles every turbo button due by the end of the current wheel slot at
+ * `now`, and returns the resulting state
+ */
+arcade_buttons turbo_expire(turbo_engine* turbo, uint64_t now)
+{
+    uint64_t last = wheel_slot(now), slot_end = (last + 1) * TURBO_TICK;
+    uint16_t due = 0;
+    if (!turbo->held)
+    {
+        return turbo->input | turbo->off;
+    }
+
+    // Visit every slot passed since the last expiry, at most one revolution,
+    // picking the buttons due in this round of the wheel
+    if (last - turbo->cursor >= TURBO_WHEEL_SLOTS)
+    {
+        turbo->cursor = last - TURBO_WHEEL_SLOTS + 1;
+    }
+    for (; turbo->cursor <= last; turbo->cursor++)
+    {
+        uint16_t* slot = &turbo->wheel[turbo->cursor & (TURBO_WHEEL_SLOTS - 1)];
+        for (uint16_t bits = *slot; bits; bits &= bits - 1)
+        {
+            int index = __builtin_ctz(bits);
+            if (turbo->next[index] < slot_end)
+            {
+                due |= 1 << index;
+                *slot &= ~(1 << index);
+            }
+        }
+    }
+    turbo->cursor = last;
+
+    // Toggle together, rescheduling from the ideal time so errors do not add up
+    if (due & (due - 1)) turbo->batches++;
+    for (; due; due &= due - 1)
+    {
+        int index = __builtin_ctz(due);
+        uint64_t ideal = turbo->next[index];
+        histogram_add(&turbo->jitter, now > ideal ? now - ideal : ideal - now);
+        turbo->off ^= 1 << index;
+        turbo->toggles++;
+        schedule_toggle(turbo, index, ideal + ((turbo->off >> index) & 1
+            ? turbo->period[index] - turbo->on_time[index]
+            : turbo->on_time[index]));
+    }
+    return turbo->input | turbo->off;
+}
+
+/*
+ * Returns the time of the next toggle, or 0 if no turbo button is held
+ */
+uint64_t turbo_deadline(const turbo_engine* turbo)
+{
+    uint64_t deadline = 0;
+    if (!turbo->held)
+    {
+        return 0;
+    }
+
+    // The first slot holding a button due in its round has the next toggle
+    for (uint64_t i = 0; i < TURBO_WHEEL_SLOTS; i++)
+    {
+        uint64_t slot = turbo->cursor + i;
+        uint16_t bits = turbo->wheel[slot & (TURBO_WHEEL_SLOTS - 1)];
+        for (; bits; bits &= bits - 1)
+        {
+            uint64_t next = turbo->next[__builtin_ctz(bits)];
+            if (next < (slot + 1) * TURBO_TICK
+                && (!deadline || next < deadline))
+            {
+                deadline = next;
+            }
+        }
+        if (deadline)
+        {
+            return deadline;
+        }
+    }
+
+    // Every toggle is more than a revolution away
+    for (uint16_t bits = turbo->held; bits; bits &= bits - 1)
+    {
+        uint64_t next = turbo->next[__builtin_ctz(bits)];
+        if (!deadline || next < deadline) deadline = next;
+    }
+    return deadline;
+}
@@ -0,0 +1,65 @@
+/*
+ * Implements per button turbo, toggling held buttons from a timer wheel
+ */
+
+#ifndef TURBO_H
+#define TURBO_H
+
+#include <stdint.h>
+
+#include "arcade_buttons.h"
+#include "histogram.h"
+#include "keymap.h"
+
+#define TURBO_WHEEL_SLOTS   128         // Power of two
+#define TURBO_TICK          500000ULL   // ns covered by a wheel slot
+#define TURBO_MAX_RATE      100         // Hz
+
+typedef struct {
+    uint16_t buttons;                   // Buttons with turbo enabled
+    uint64_t period[KEYMAP_BUTTONS];    // ns of a press and release cycle
+    uint64_t on_time[KEYMAP_BUTTONS];   // ns pressed within a cycle
+    arcade_buttons input;               // Last state fed in
+    uint16_t held;                      // Turbo buttons held
+    uint16_t off;                       // Held turbo buttons in their off phase
+    uint64_t next[KEYMAP_BUTTONS];      // Ideal time of each button's toggle
+    uint16_t wheel[TURBO_WHEEL_SLOTS];  // Buttons due in each slot
+    uint64_t cursor;                    // Next slot to expire
+    histogram jitter;                   // Toggle time against its ideal
+    unsigned long toggles;
+    unsigned long batches;              // Wakeups toggling several buttons
+} turbo_engine;
+
+/*
+ * Sets up `turbo` without any turbo buttons
+ */
+void init_turbo(turbo_engine* turbo);
+
+/*
+ * Enables turbo on the button called `button` with `value` giving the rate in
+ * Hz and optionally the percentage of each cycle spent pressed ("15" or
+ * "15 30"), or "off". Returns zero on success, and a negative value on an
+ * unknown button or invalid value
+ */
+int configure_turbo(turbo_engine* turbo, const char* button,
+    const char* value);
+
+/*
+ * Feeds `state` at `now` (CLOCK_MONOTONIC ns) and returns it with held turbo
+ * buttons in their off phase released. New presses start pressed
+ */
+arcade_buttons turbo_update(turbo_engine* turbo, arcade_buttons state,
+    uint64_t now);
+
+/*
+ * Toggles every turbo button due by the end of the current wheel slot at
+ * `now`, and returns the resulting state
+ */
+arcade_buttons turbo_expire(turbo_engine* turbo, uint64_t now);
+
+/*
+ * Returns the time of the next toggle, or 0 if no turbo button is held
+ */
+uint64_t turbo_deadline(const turbo_engine* turbo);
+
+#endif